@@ -1,9 +1,14 @@
 #include <stdlib.h>
+#include <string.h>
 
 #include "../include/chunk.h"
 #include "../include/memory.h"
 #include "../include/vm.h"
 
+// Line numbers and code share one allocation, lines first, so growing a
+// chunk either succeeds or fails as a whole.
+#define CHUNK_BYTES(capacity) ((size_t)(capacity) * (sizeof(int) + sizeof(uint8_t)))
+
 void initChunk(Chunk* chunk) {
   chunk->count = 0;
   chunk->capacity = 0;
@@ -13,8 +18,7 @@ void initChunk(Chunk* chunk) {
 }
 
 void freeChunk(Chunk* chunk) {
-  FREE_ARRAY(uint8_t, chunk->code, chunk->capacity);
-  FREE_ARRAY(int, chunk->lines, chunk->capacity);
+  reallocate(chunk->lines, CHUNK_BYTES(chunk->capacity), 0);
   freeValueArray(&chunk->constants);
   initChunk(chunk);
 }
@@ -22,9 +26,16 @@ void freeChunk(Chunk* chunk) {
 void writeChunk(Chunk* chunk, uint8_t byte, int line) {
   if (chunk->capacity < chunk->count + 1) {
     int oldCapacity = chunk->capacity;
-    chunk->capacity = GROW_CAPACITY(oldCapacity);
-    chunk->code = GROW_ARRAY(uint8_t, chunk->code, oldCapacity, chunk->capacity);
-    chunk->lines = GROW_ARRAY(int, chunk->lines, oldCapacity, chunk->capacity);
+    int capacity = GROW_CAPACITY(oldCapacity);
+    int* lines = (int*)reallocate(chunk->lines, CHUNK_BYTES(oldCapacity), CHUNK_BYTES(capacity));
+
+    // The code moves up to make room for the new line numbers.
+    uint8_t* code = (uint8_t*)(lines + capacity);
+    memmove(code, lines + oldCapacity, oldCapacity);
+
+    chunk->lines = lines;
+    chunk->code = code;
+    chunk->capacity = capacity;
   }
 
   chunk->code[chunk->count] = byte;
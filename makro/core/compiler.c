@@ -6,6 +6,7 @@
 #include "../include/memory.h"
 #include "../include/common.h"
 #include "../include/lexer.h"
+#include "../include/number.h"
 
 #ifdef DEBUG_PRINT_CODE
 #include "../include/debug.h"
@@ -14,6 +15,7 @@
 typedef struct {
   Token current;
   Token previous;
+  ObjectSource* source;
   bool hadError;
   bool errorMode;
 } Parser;
@@ -25,6 +27,10 @@ typedef enum {
   PREC_AND,
   PREC_EQUALITY,
   PREC_COMPARISON,
+  PREC_BIT_OR,
+  PREC_BIT_XOR,
+  PREC_BIT_AND,
+  PREC_SHIFT,
   PREC_TERM,
   PREC_FACTOR,
   PREC_UNARY,
@@ -199,7 +205,7 @@ static void initCompiler(Compiler* compiler, FunctionType type) {
   current = compiler;
 
   if (type != TYPE_SCRIPT) {
-    current->function->name = copyString(parser.previous.start, parser.previous.length);
+    current->function->name = borrowString((Object*)parser.source, parser.previous.start, parser.previous.length, parser.previous.hash);
   }
 
   Local* local = &current->locals[current->localCount++];
@@ -214,8 +220,12 @@ static ObjectFunction* endCompiler() {
   ObjectFunction* function = current->function;
 
   #ifdef DEBUG_PRINT_CODE
-    if (!parser.hadError) {
-      disassembleChunk(currentChunk(), function->name != NULL ? function->name->chars : "<script>");  
+    if (vm.debug.printCode && !parser.hadError) {
+      if (function->name != NULL) {
+        disassembleChunk(currentChunk(), function->name->chars, function->name->length);
+      } else {
+        disassembleChunk(currentChunk(), "<script>", 8);
+      }
     }
   #endif
 
@@ -266,6 +276,13 @@ static void binary(bool canAssign) {
     case TOKEN_MINUS: emitByte(OP_SUBTRACT); break;
     case TOKEN_STAR: emitByte(OP_MULTIPLY); break;
     case TOKEN_SLASH: emitByte(OP_DIVIDE); break;
+    case TOKEN_TILDE_SLASH: emitByte(OP_INTEGER_DIVIDE); break;
+    case TOKEN_PERCENT: emitByte(OP_MODULO); break;
+    case TOKEN_AMPERSAND: emitByte(OP_BIT_AND); break;
+    case TOKEN_PIPE: emitByte(OP_BIT_OR); break;
+    case TOKEN_CARET: emitByte(OP_BIT_XOR); break;
+    case TOKEN_LESS_LESS: emitByte(OP_SHIFT_LEFT); break;
+    case TOKEN_GREATER_GREATER: emitByte(OP_SHIFT_RIGHT); break;
     default: return;
   }
 }
@@ -287,6 +304,34 @@ static void dot(bool canAssign) {
   }
 }
 
+static void subscript(bool canAssign) {
+  expression();
+  consume(TOKEN_RIGHT_BRACKET, "Expect ']' after index");
+
+  if (canAssign && match(TOKEN_EQUAL)) {
+    expression();
+    emitByte(OP_SET_INDEX);
+  } else {
+    emitByte(OP_GET_INDEX);
+  }
+}
+
+static void list(bool canAssign) {
+  int itemCount = 0;
+  if (!check(TOKEN_RIGHT_BRACKET)) {
+    do {
+      expression();
+      if (itemCount == 255) {
+        error("Can't have more than 255 items in a list literal");
+      }
+      itemCount++;
+    } while (match(TOKEN_COMMA));
+  }
+
+  consume(TOKEN_RIGHT_BRACKET, "Expect ']' after list items");
+  emitBytes(OP_BUILD_LIST, (uint8_t)itemCount);
+}
+
 static void literal(bool canAssign) {
   switch (parser.previous.type) {
     case TOKEN_TRUE: emitByte(OP_TRUE); break;
@@ -302,10 +347,28 @@ static void grouping(bool canAssign) {
 }
 
 static void number(bool canAssign) {
-  double value = strtod(parser.previous.start, NULL);
+  double value;
+  parseNumber(parser.previous.start, parser.previous.length, &value);
   emitConstant(NUMBER_VAL(value));
 }
 
+// Literals too large for an integer fall back to the nearest double.
+static void integer(bool canAssign) {
+  int64_t value = 0;
+
+  for (int i = 0; i < parser.previous.length; i++) {
+    int digit = parser.previous.start[i] - '0';
+    if (value > (INT64_MAX - digit) / 10) {
+      number(canAssign);
+      return;
+    }
+
+    value = value * 10 + digit;
+  }
+
+  emitConstant(INTEGER_VAL(value));
+}
+
 static void and_(bool canAssign) {
   int endJump = emitJump(OP_JUMP_IF_FALSE);
 
@@ -329,7 +392,7 @@ static void or_(bool canAssign) {
 static void string(bool canAssign) {
   emitConstant(
     OBJECT_VAL(
-      copyString(parser.previous.start + 1, parser.previous.length - 2)
+      borrowString((Object*)parser.source, parser.previous.start + 1, parser.previous.length - 2, parser.previous.hash)
     )
   );
 }
@@ -370,6 +433,7 @@ static void unary(bool canAssign) {
   switch (operatorType) {
     case TOKEN_BANG: emitByte(OP_NOT); break;
     case TOKEN_MINUS: emitByte(OP_NEGATE); break;
+    case TOKEN_TILDE: emitByte(OP_BIT_NOT); break;
     default: return;
   }
 }
@@ -379,6 +443,8 @@ ParseRule rules[] = {
   [TOKEN_RIGHT_PAREN] = {NULL, NULL, PREC_NONE},
   [TOKEN_LEFT_BRACE] = {NULL, NULL, PREC_NONE}, 
   [TOKEN_RIGHT_BRACE] = {NULL, NULL, PREC_NONE},
+  [TOKEN_LEFT_BRACKET] = {list, subscript, PREC_CALL},
+  [TOKEN_RIGHT_BRACKET] = {NULL, NULL, PREC_NONE},
   [TOKEN_COMMA] = {NULL, NULL, PREC_NONE},
   [TOKEN_DOT] = {NULL, dot, PREC_CALL},
   [TOKEN_MINUS] = {unary, binary, PREC_TERM},
@@ -386,17 +452,26 @@ ParseRule rules[] = {
   [TOKEN_SEMICOLON] = {NULL, NULL, PREC_NONE},
   [TOKEN_SLASH] = {NULL, binary, PREC_FACTOR},
   [TOKEN_STAR] = {NULL, binary, PREC_FACTOR},
+  [TOKEN_PERCENT] = {NULL, binary, PREC_FACTOR},
+  [TOKEN_AMPERSAND] = {NULL, binary, PREC_BIT_AND},
+  [TOKEN_PIPE] = {NULL, binary, PREC_BIT_OR},
+  [TOKEN_CARET] = {NULL, binary, PREC_BIT_XOR},
   [TOKEN_BANG] = {unary, NULL, PREC_NONE},
   [TOKEN_BANG_EQUAL] = {NULL, binary, PREC_EQUALITY},
   [TOKEN_EQUAL] = {NULL, NULL, PREC_NONE},
   [TOKEN_EQUAL_EQUAL] = {NULL, binary, PREC_EQUALITY},
   [TOKEN_GREATER] = {NULL, binary, PREC_COMPARISON},
   [TOKEN_GREATER_EQUAL] = {NULL, binary, PREC_COMPARISON},
+  [TOKEN_GREATER_GREATER] = {NULL, binary, PREC_SHIFT},
   [TOKEN_LESS] = {NULL, binary, PREC_COMPARISON},
   [TOKEN_LESS_EQUAL] = {NULL, binary, PREC_COMPARISON},
+  [TOKEN_LESS_LESS] = {NULL, binary, PREC_SHIFT},
+  [TOKEN_TILDE] = {unary, NULL, PREC_NONE},
+  [TOKEN_TILDE_SLASH] = {NULL, binary, PREC_FACTOR},
   [TOKEN_IDENTIFIER] = {variable, NULL, PREC_NONE},
   [TOKEN_STRING] = {string, NULL, PREC_NONE},
   [TOKEN_NUMBER] = {number, NULL, PREC_NONE},
+  [TOKEN_INTEGER] = {integer, NULL, PREC_NONE},
   [TOKEN_AND] = {NULL, and_, PREC_AND},
   [TOKEN_CLASS] = {NULL, NULL, PREC_NONE},
   [TOKEN_ELSE] = {NULL, NULL, PREC_NONE},
@@ -440,7 +515,7 @@ static void parsePrecedence(Precedence precedence) {
 }
 
 static uint8_t identifierConstant(Token* name) {
-  return makeConstant(OBJECT_VAL(copyString(name->start, name->length)));
+  return makeConstant(OBJECT_VAL(borrowString((Object*)parser.source, name->start, name->length, name->hash)));
 }
 
 static bool identifiersEqual(Token* a, Token* b) {
@@ -488,13 +563,13 @@ static int resolveUpvalue(Compiler* compiler, Token* name) {
   if (compiler->enclosing == NULL) return -1;
 
   int local = resolveLocal(compiler->enclosing, name);
-  if (local == -1) {
+  if (local != -1) {
+    compiler->enclosing->locals[local].isCaptured = true;
     return addUpvalue(compiler, (uint8_t)local, true);
   }
 
   int upvalue = resolveUpvalue(compiler->enclosing, name);
   if (upvalue != -1) {
-    compiler->enclosing->locals[local].isCaptured = true;
     return addUpvalue(compiler, (uint8_t)upvalue, false);
   }
 
@@ -811,8 +886,9 @@ static void statement() {
   }
 }
 
-ObjectFunction* compile(const char* source) {
-  initLexer(source);
+ObjectFunction* compile(ObjectSource* source) {
+  parser.source = source;
+  initLexer(source->chars, source->length);
   Compiler compiler;
   initCompiler(&compiler, TYPE_SCRIPT);
 
@@ -826,11 +902,20 @@ ObjectFunction* compile(const char* source) {
   }
 
   ObjectFunction* function = endCompiler();
+  parser.source = NULL;
   return parser.hadError ? NULL : function;
 }
 
+// Drops the compiler chain after an error unwound through compile(); the
+// Compiler structs it points to lived on the abandoned C stack.
+void resetCompiler() {
+  current = NULL;
+  parser.source = NULL;
+}
+
 void markCompilerRoots() {
   Compiler* compiler = current;
+  markObject((Object*)parser.source);
   
   while (compiler != NULL) {
     markObject((Object*)compiler->function);
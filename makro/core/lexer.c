@@ -3,18 +3,22 @@
 
 #include "../include/common.h"
 #include "../include/lexer.h"
+#include "../include/object.h"
 
 typedef struct {
   const char* start;
   const char* current;
+  const char* end;
   int line;
 } Lexer;
 
 Lexer lexer;
 
-void initLexer(const char* source) {
+// The source is a span and need not be NUL-terminated.
+void initLexer(const char* source, int length) {
   lexer.start = source;
   lexer.current = source;
+  lexer.end = source + length;
   lexer.line = 1;
 }
 
@@ -27,7 +31,7 @@ static bool isDigit(char c) {
 }
 
 static bool isAtEnd() {
-  return *lexer.current == '\0';
+  return lexer.current >= lexer.end;
 }
 
 static char advance() {
@@ -37,11 +41,12 @@ static char advance() {
 }
 
 static char peek() {
+  if (isAtEnd()) return '\0';
   return *lexer.current;
 }
 
 static char peekNext() {
-  if (isAtEnd()) return '\0';
+  if (lexer.end - lexer.current < 2) return '\0';
   return lexer.current[1];
 }
 
@@ -59,6 +64,7 @@ static Token makeToken(TokenType type) {
   token.start = lexer.start;
   token.length = (int)(lexer.current - lexer.start);
   token.line = lexer.line;
+  token.hash = 0;
 
   return token;
 }
@@ -69,7 +75,8 @@ static Token errorToken(const char* message) {
   token.start = message;
   token.length = (int)strlen(message);
   token.line = lexer.line;
-  
+  token.hash = 0;
+
   return token;
 }
 
@@ -122,7 +129,7 @@ static TokenType identifierType() {
       }
       break;
     case 'i': return checkKeyword(1, 1, "f", TOKEN_IF);
-    case 'n': return checkKeyword(1, 2, "ull", TOKEN_NULL);
+    case 'n': return checkKeyword(1, 3, "ull", TOKEN_NULL);
     case 'o': return checkKeyword(1, 1, "r", TOKEN_OR);
     case 'p': return checkKeyword(1, 4, "rint", TOKEN_PRINT);
     case 'r': return checkKeyword(1, 5, "eturn", TOKEN_RETURN);
@@ -143,18 +150,23 @@ static TokenType identifierType() {
 
 static Token identifier() {
   while (isAlpha(peek()) || isDigit(peek())) advance();
-  return makeToken(identifierType());
+
+  Token token = makeToken(identifierType());
+  if (token.type == TOKEN_IDENTIFIER) token.hash = hashString(token.start, token.length);
+  return token;
 }
 
+// A literal without a fractional part is an integer.
 static Token number() {
   while (isDigit(peek())) advance();
 
   if (peek() == '.' && isDigit(peekNext())) {
     advance();
     while (isDigit(peek())) advance();
+    return makeToken(TOKEN_NUMBER);
   }
 
-  return makeToken(TOKEN_NUMBER);
+  return makeToken(TOKEN_INTEGER);
 }
 
 static Token string() {
@@ -166,7 +178,10 @@ static Token string() {
   if (isAtEnd()) return errorToken("Unterminated string");
 
   advance();
-  return makeToken(TOKEN_STRING);
+
+  Token token = makeToken(TOKEN_STRING);
+  token.hash = hashString(token.start + 1, token.length - 2);
+  return token;
 }
 
 Token scanToken() {
@@ -183,6 +198,8 @@ Token scanToken() {
     case ')': return makeToken(TOKEN_RIGHT_PAREN);
     case '{': return makeToken(TOKEN_LEFT_BRACE);
     case '}': return makeToken(TOKEN_RIGHT_BRACE);
+    case '[': return makeToken(TOKEN_LEFT_BRACKET);
+    case ']': return makeToken(TOKEN_RIGHT_BRACKET);
     case ';': return makeToken(TOKEN_SEMICOLON);
     case ',': return makeToken(TOKEN_COMMA);
     case '.': return makeToken(TOKEN_DOT);
@@ -190,13 +207,21 @@ Token scanToken() {
     case '-': return makeToken(TOKEN_MINUS);
     case '*': return makeToken(TOKEN_STAR);
     case '/': return makeToken(TOKEN_SLASH);
+    case '%': return makeToken(TOKEN_PERCENT);
+    case '&': return makeToken(TOKEN_AMPERSAND);
+    case '|': return makeToken(TOKEN_PIPE);
+    case '^': return makeToken(TOKEN_CARET);
+    case '~':
+      return makeToken(match('/') ? TOKEN_TILDE_SLASH : TOKEN_TILDE);
     case '!':
       return makeToken(match('=') ? TOKEN_BANG_EQUAL : TOKEN_BANG);
     case '=':
       return makeToken(match('=') ? TOKEN_EQUAL_EQUAL : TOKEN_EQUAL);
     case '<':
+      if (match('<')) return makeToken(TOKEN_LESS_LESS);
       return makeToken(match('=') ? TOKEN_LESS_EQUAL : TOKEN_LESS);
     case '>':
+      if (match('>')) return makeToken(TOKEN_GREATER_GREATER);
       return makeToken(match('=') ? TOKEN_GREATER_EQUAL : TOKEN_GREATER);
     case '"': return string();
   }
@@ -0,0 +1,129 @@
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "../include/memory.h"
+#include "../include/output.h"
+
+void initOutput(OutputBuffer* output, int fd, size_t size) {
+  output->bytes = NULL;
+  output->count = 0;
+  output->capacity = 0;
+  output->size = size;
+  output->fd = fd;
+  output->failed = false;
+}
+
+// Standard output takes its size from MAKRO_OUTPUT_BUFFER, like the
+// MAKRO_GC_* settings.
+void initStandardOutput(OutputBuffer* output) {
+  initOutput(output, STDOUT_FILENO, OUTPUT_DEFAULT_SIZE);
+
+  const char* value = getenv("MAKRO_OUTPUT_BUFFER");
+  if (value != NULL && !parseSize(value, &output->size)) {
+    fprintf(stderr, "Ignoring invalid MAKRO_OUTPUT_BUFFER value \"%s\".\n", value);
+  }
+}
+
+// Flushes what is pending and drops the old buffer; the next write
+// allocates one of the new size.
+void setOutputSize(OutputBuffer* output, size_t size) {
+  flushOutput(output);
+  free(output->bytes);
+  output->bytes = NULL;
+  output->capacity = 0;
+  output->size = size;
+}
+
+void freeOutput(OutputBuffer* output) {
+  setOutputSize(output, output->size);
+}
+
+// Retries interrupted and partial writes until everything is out.
+static bool writeAll(int fd, const char* bytes, size_t length) {
+  while (length > 0) {
+    ssize_t written = write(fd, bytes, length);
+    if (written < 0) {
+      if (errno == EINTR) continue;
+      return false;
+    }
+
+    bytes += written;
+    length -= (size_t)written;
+  }
+
+  return true;
+}
+
+// Anything still in stdio's stdout buffer, such as debug traces or the
+// REPL prompt, was printed first and goes out first. Pending output is
+// dropped if it cannot be written. Returns false if any write since the
+// last flush failed.
+bool flushOutput(OutputBuffer* output) {
+  if (output->fd == STDOUT_FILENO) fflush(stdout);
+
+  if (output->count > 0 && output->fd != OUTPUT_MEMORY && !writeAll(output->fd, output->bytes, output->count)) {
+    output->failed = true;
+  }
+
+  bool written = !output->failed;
+  output->count = 0;
+  output->failed = false;
+  return written;
+}
+
+// Makes room for length more bytes in an in-memory buffer, doubling it.
+static bool growBuffer(OutputBuffer* output, size_t length) {
+  size_t capacity = output->capacity > output->size ? output->capacity : output->size;
+  if (capacity < 256) capacity = 256;
+  while (capacity - output->count < length) capacity *= 2;
+
+  char* bytes = (char*)realloc(output->bytes, capacity);
+  if (bytes == NULL) {
+    output->failed = true;
+    return false;
+  }
+
+  output->bytes = bytes;
+  output->capacity = capacity;
+  return true;
+}
+
+// Falls back to writing straight through if the buffer cannot be had.
+static void allocateBuffer(OutputBuffer* output) {
+  if (output->bytes != NULL || output->size == 0) return;
+
+  output->bytes = (char*)malloc(output->size);
+  output->capacity = output->bytes != NULL ? output->size : 0;
+}
+
+// Pieces larger than the whole buffer skip it.
+void writeOutputSlow(OutputBuffer* output, const char* bytes, size_t length) {
+  if (output->fd == OUTPUT_MEMORY) {
+    if (growBuffer(output, length)) {
+      memcpy(output->bytes + output->count, bytes, length);
+      output->count += length;
+    }
+    return;
+  }
+
+  allocateBuffer(output);
+  if (length > output->capacity - output->count) flushOutput(output);
+
+  if (length <= output->capacity) {
+    memcpy(output->bytes + output->count, bytes, length);
+    output->count += length;
+    return;
+  }
+
+  if (!writeAll(output->fd, bytes, length)) output->failed = true;
+}
+
+char* reserveOutputSlow(OutputBuffer* output, size_t length) {
+  if (output->fd == OUTPUT_MEMORY) return growBuffer(output, length) ? output->bytes + output->count : NULL;
+
+  allocateBuffer(output);
+  if (length > output->capacity - output->count) flushOutput(output);
+  return length <= output->capacity ? output->bytes + output->count : NULL;
+}
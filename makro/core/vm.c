@@ -1,8 +1,12 @@
+#include <setjmp.h>
 #include <stdarg.h>
 #include <stdint.h>
+#include <stdlib.h>
 #include <stdio.h>
+#include <math.h>
 #include <string.h>
 #include <time.h>
+#include <unistd.h>
 
 #include "../include/compiler.h"
 #include "../include/common.h"
@@ -10,6 +14,16 @@
 #include "../include/object.h"
 #include "../include/memory.h"
 #include "../include/clock.h"
+#include "../include/file.h"
+#include "../include/float64array.h"
+#include "../include/gcstats.h"
+#include "../include/io.h"
+#include "../include/json.h"
+#include "../include/list.h"
+#include "../include/mapnatives.h"
+#include "../include/serial.h"
+#include "../include/stringbuilder.h"
+#include "../include/stringlib.h"
 #include "../include/vm.h"
 
 VM vm;
@@ -20,11 +34,9 @@ static void resetStack() {
   vm.openUpvalues = NULL;
 }
 
-static void runtimeError(const char* format, ...) {
-  va_list args;
-  va_start(args, format);
+static void reportError(const char* format, va_list args) {
+  flushOutput(&vm.output);
   vfprintf(stderr, format, args);
-  va_end(args);
   fputs("\n", stderr);
 
   for (int i = vm.frameCount - 1; i >= 0; i--) {
@@ -36,13 +48,40 @@ static void runtimeError(const char* format, ...) {
     if (function->name == NULL) {
       fprintf(stderr, "script\n");
     } else {
-      fprintf(stderr, "%s()\n", function->name->chars);
+      fprintf(stderr, "%.*s()\n", function->name->length, function->name->chars);
     }
   }
 
   resetStack();
 }
 
+static void runtimeError(const char* format, ...) {
+  va_list args;
+  va_start(args, format);
+  reportError(format, args);
+  va_end(args);
+}
+
+// Reports a runtime error from anywhere below interpret(), including deep
+// inside the allocator, and unwinds straight back to interpret().
+_Noreturn void throwRuntimeError(const char* format, ...) {
+  va_list args;
+  va_start(args, format);
+  reportError(format, args);
+  va_end(args);
+
+  if (vm.errorHandler == NULL) exit(70);
+  longjmp(*vm.errorHandler, 1);
+}
+
+// Passes an error that a local handler caught, after its cleanup, on to the
+// handler that was installed before it. The error has already been reported.
+_Noreturn void rethrowRuntimeError(jmp_buf* handler) {
+  vm.errorHandler = handler;
+  if (handler == NULL) exit(70);
+  longjmp(*handler, 1);
+}
+
 static void defineNative(const char* name, NativeFn function) {
   push(OBJECT_VAL(copyString(name, (int)strlen(name))));
   push(OBJECT_VAL(newNative(function)));
@@ -51,26 +90,100 @@ static void defineNative(const char* name, NativeFn function) {
   pop();
 }
 
+// Whatever path the process exits by, buffered output is written first.
+static void flushOutputAtExit() {
+  flushOutput(&vm.output);
+}
+
 void initVM() {
+  static bool exitHookRegistered = false;
+  if (!exitHookRegistered) exitHookRegistered = atexit(flushOutputAtExit) == 0;
+
   resetStack();
-  vm.objects = NULL;
+  vm.errorHandler = NULL;
+  initStandardOutput(&vm.output);
+  memset(&vm.debug, 0, sizeof(vm.debug));
+  initHeap(&vm.heap);
   vm.bytesAllocated = 0;
-  vm.nextGC = 1024 * 1024;
+  vm.shouldCompact = false;
+  memset(&vm.gcStats, 0, sizeof(vm.gcStats));
+  initGCConfig(&vm.gcConfig);
+  vm.nextGC = vm.gcConfig.initialThreshold;
 
   vm.grayCount = 0;
   vm.grayCapacity = 0;
   vm.grayStack = NULL;
 
+  vm.jsonClass = NULL;
   initTable(&vm.globals);
-  initTable(&vm.strings);
+  initInternSet(&vm.strings);
+
+  // The class of the objects jsonParse() and jsonRead() materialize.
+  push(OBJECT_VAL(copyString("JsonObject", 10)));
+  vm.jsonClass = newClass(AS_STRING(vm.stack[0]));
+  pop();
 
   defineNative("clock", clockNative);
+  defineNative("gcStats", gcStatsNative);
+  defineNative("flush", flushNative);
+  defineNative("openFile", openFileNative);
+  defineNative("close", closeNative);
+  defineNative("readFile", readFileNative);
+  defineNative("readLine", readLineNative);
+  defineNative("readBytes", readBytesNative);
+  defineNative("readFloat64s", readFloat64sNative);
+  defineNative("write", writeNative);
+  defineNative("writeFloat64s", writeFloat64sNative);
+  defineNative("jsonParse", jsonParseNative);
+  defineNative("jsonStringify", jsonStringifyNative);
+  defineNative("jsonRead", jsonReadNative);
+  defineNative("jsonWrite", jsonWriteNative);
+  defineNative("serialize", serializeNative);
+  defineNative("deserialize", deserializeNative);
+  defineNative("append", appendNative);
+  defineNative("pop", popNative);
+  defineNative("length", lengthNative);
+  defineNative("slice", sliceNative);
+  defineNative("Float64Array", float64ArrayNative);
+  defineNative("f64Add", f64AddNative);
+  defineNative("f64Mul", f64MulNative);
+  defineNative("f64Scale", f64ScaleNative);
+  defineNative("f64Sum", f64SumNative);
+  defineNative("f64Dot", f64DotNative);
+  defineNative("f64Min", f64MinNative);
+  defineNative("f64Max", f64MaxNative);
+  defineNative("f64PrefixSum", f64PrefixSumNative);
+  defineNative("f64Fill", f64FillNative);
+  defineNative("Map", mapNative);
+  defineNative("mapGet", mapGetNative);
+  defineNative("mapSet", mapSetNative);
+  defineNative("mapHas", mapHasNative);
+  defineNative("mapDelete", mapDeleteNative);
+  defineNative("mapSize", mapSizeNative);
+  defineNative("mapKeys", mapKeysNative);
+  defineNative("mapValues", mapValuesNative);
+  defineNative("StringBuilder", stringBuilderNative);
+  defineNative("appendNumber", appendNumberNative);
+  defineNative("toString", toStringNative);
+  defineNative("indexOf", indexOfNative);
+  defineNative("contains", containsNative);
+  defineNative("startsWith", startsWithNative);
+  defineNative("endsWith", endsWithNative);
+  defineNative("substring", substringNative);
+  defineNative("trim", trimNative);
+  defineNative("split", splitNative);
+  defineNative("join", joinNative);
+  defineNative("replace", replaceNative);
+  defineNative("toFixed", toFixedNative);
 }
 
 void freeVM() {
+  if (vm.gcConfig.reportStats) reportGCStats();
+
   freeTable(&vm.globals);
-  freeTable(&vm.strings);
+  freeInternSet(&vm.strings);
   freeObjects();
+  freeOutput(&vm.output);
 }
 
 void push(Value value) {
@@ -106,6 +219,51 @@ static bool call(ObjectClosure* closure, int argCount) {
   return true;
 }
 
+// Checks that index is an integer in [0, count) and stores it in position.
+static bool checkIndex(Value index, int count, int* position) {
+  if (IS_INTEGER(index)) {
+    if (AS_INTEGER(index) < 0 || AS_INTEGER(index) >= count) {
+      runtimeError("Index out of range");
+      return false;
+    }
+
+    *position = (int)AS_INTEGER(index);
+    return true;
+  }
+
+  if (!IS_NUMBER(index)) {
+    runtimeError("Index must be a number");
+    return false;
+  }
+
+  double number = AS_NUMBER(index);
+  if (!(number >= 0 && number < count)) {
+    runtimeError("Index out of range");
+    return false;
+  }
+
+  *position = (int)number;
+  if (*position != number) {
+    runtimeError("Index must be an integer");
+    return false;
+  }
+
+  return true;
+}
+
+// Map keys are compared by value, so a rope key is flattened in its stack
+// slot first; that keeps the flattened string rooted while the map grows.
+static bool checkMapKey(Value* slot) {
+  if (IS_ROPE(*slot)) *slot = OBJECT_VAL(flattenRope(AS_ROPE(*slot)));
+
+  if (IS_NUMBER(*slot) && AS_NUMBER(*slot) != AS_NUMBER(*slot)) {
+    runtimeError("Map key cannot be NaN");
+    return false;
+  }
+
+  return true;
+}
+
 static bool callValue(Value caller, int argCount) {
   if (IS_OBJECT(caller)) {
     switch (OBJECT_TYPE(caller)) {
@@ -167,17 +325,30 @@ static bool isFalse(Value value) {
   return IS_NULL(value) || (IS_BOOL(value) && !AS_BOOL(value));
 }
 
+static int stringLength(Value value) {
+  return IS_ROPE(value) ? AS_ROPE(value)->length : AS_STRING(value)->length;
+}
+
+// Short results are copied and interned straight away. Anything longer is
+// deferred as a rope so building a string in a loop stays linear.
 static void concatenate() {
-  ObjectString* b = AS_STRING(peek(0));
-  ObjectString* a = AS_STRING(peek(1));
+  int64_t total = (int64_t)stringLength(peek(1)) + stringLength(peek(0));
+  if (total > INT32_MAX - 1) throwRuntimeError("String is too long");
 
-  int length = a->length + b->length;
-  char* chars = ALLOCATE(char, length + 1);
-  memcpy(chars, a->chars, a->length);
-  memcpy(chars + a->length, b->chars, b->length);
-  chars[length] = '\0';
+  int length = (int)total;
+  Object* result;
 
-  ObjectString* result = takeString(chars, length);
+  if (length < ROPE_MIN_LENGTH && IS_STRING(peek(0)) && IS_STRING(peek(1))) {
+    ObjectString* b = AS_STRING(peek(0));
+    ObjectString* a = AS_STRING(peek(1));
+
+    ObjectString* string = allocateString(length);
+    memcpy(string->chars, a->chars, a->length);
+    memcpy(string->chars + a->length, b->chars, b->length);
+    result = (Object*)string;
+  } else {
+    result = (Object*)newRope(AS_OBJECT(peek(1)), AS_OBJECT(peek(0)), length);
+  }
 
   pop();
   pop();
@@ -191,29 +362,69 @@ static InterpretResult run() {
   #define READ_CONSTANT() (frame->closure->function->chunk.constants.values[READ_BYTE()])
   #define READ_SHORT() (frame->ip += 2, (uint16_t)((frame->ip[-2] << 8) | frame->ip[-1]))
   #define READ_STRING() AS_STRING(READ_CONSTANT())
-  #define BINARY_OP(valueType, op) \
+  // Two integers stay on the integer path unless checkedOp reports an
+  // overflow, in which case the result is computed in doubles like any
+  // mixed pair of operands.
+  #define ARITHMETIC_OP(checkedOp, op) \
+    do { \
+      Value b = peek(0); \
+      Value a = peek(1); \
+      int64_t result; \
+      if (IS_INTEGER(a) && IS_INTEGER(b) && !checkedOp(AS_INTEGER(a), AS_INTEGER(b), &result)) { \
+        pop(); \
+        pop(); \
+        push(INTEGER_VAL(result)); \
+        break; \
+      } \
+      if (!IS_NUMERIC(a) || !IS_NUMERIC(b)) { \
+        runtimeError("Operands must be numbers."); \
+        return INTERPRET_RUNTIME_ERROR; \
+      } \
+      pop(); \
+      pop(); \
+      push(NUMBER_VAL(AS_NUMERIC(a) op AS_NUMERIC(b))); \
+    } while (false)
+  // Pushes whether left < right. Mixed pairs go through valuesLess(), which
+  // compares them exactly instead of rounding the integer to a double.
+  #define COMPARISON_OP(left, right) \
     do { \
-      if (!IS_NUMBER(peek(0)) || !IS_NUMBER(peek(1))) { \
+      Value b = pop(); \
+      Value a = pop(); \
+      if (IS_INTEGER(a) && IS_INTEGER(b)) { \
+        push(BOOL_VAL(AS_INTEGER(left) < AS_INTEGER(right))); \
+        break; \
+      } \
+      if (!IS_NUMERIC(a) || !IS_NUMERIC(b)) { \
         runtimeError("Operands must be numbers."); \
         return INTERPRET_RUNTIME_ERROR; \
       } \
-      double b = AS_NUMBER(pop()); \
-      double a = AS_NUMBER(pop()); \
-      push(valueType(a op b)); \
+      push(BOOL_VAL(valuesLess(left, right))); \
+    } while (false)
+  #define BITWISE_OP(op) \
+    do { \
+      if (!IS_INTEGER(peek(0)) || !IS_INTEGER(peek(1))) { \
+        runtimeError("Operands must be integers"); \
+        return INTERPRET_RUNTIME_ERROR; \
+      } \
+      int64_t b = AS_INTEGER(pop()); \
+      int64_t a = AS_INTEGER(pop()); \
+      push(INTEGER_VAL(a op b)); \
     } while (false)
 
   for (;;) {
     #ifdef DEBUG_TRACE_EXECUTION
-      printf("          ");
-      
-      for (Value* slot = vm.stack; slot < vm.stackTop; slot++) {
-        printf("[ ");
-        printValue(*slot);
-        printf(" ]");
-      }
+      if (vm.debug.traceExecution) {
+        printf("          ");
+
+        for (Value* slot = vm.stack; slot < vm.stackTop; slot++) {
+          printf("[ ");
+          printValue(*slot);
+          printf(" ]");
+        }
 
-      printf("\n");
-      disassembleInstruction(&frame->closure->function->chunk, (int)(frame->ip - frame->closure->function->chunk.code));
+        printf("\n");
+        disassembleInstruction(&frame->closure->function->chunk, (int)(frame->ip - frame->closure->function->chunk.code));
+      }
     #endif
 
     uint8_t instruction;
@@ -242,7 +453,7 @@ static InterpretResult run() {
       }
       case OP_GET_LOCAL: {
         uint8_t slot = READ_BYTE();
-        push(vm.stack[slot]);
+        push(frame->slots[slot]);
         break;
       }
       case OP_DEFINE_GLOBAL: {
@@ -255,7 +466,7 @@ static InterpretResult run() {
         ObjectString* name = READ_STRING();
         if (tableSet(&vm.globals, name, peek(0))) {
           tableDelete(&vm.globals, name);
-          runtimeError("Undefined variable '%s'", name->chars);
+          runtimeError("Undefined variable '%.*s'", name->length, name->chars);
           return INTERPRET_RUNTIME_ERROR;
         }
         break;
@@ -264,7 +475,7 @@ static InterpretResult run() {
         ObjectString* name = READ_STRING();
         Value value;
         if (!tableGet(&vm.globals, name, &value)) {
-          runtimeError("Undefined variable '%s'", name->chars);
+          runtimeError("Undefined variable '%.*s'", name->length, name->chars);
           return INTERPRET_RUNTIME_ERROR;
         }
 
@@ -310,54 +521,212 @@ static InterpretResult run() {
           break;
         }
 
-        runtimeError("Undefined property '%s'", name->chars);
+        runtimeError("Undefined property '%.*s'", name->length, name->chars);
         return INTERPRET_RUNTIME_ERROR;
       }
+      case OP_SET_INDEX: {
+        int index;
+
+        if (IS_LIST(peek(2))) {
+          ObjectList* list = AS_LIST(peek(2));
+          if (!checkIndex(peek(1), list->items.count, &index)) return INTERPRET_RUNTIME_ERROR;
+
+          list->items.values[index] = peek(0);
+        } else if (IS_FLOAT64_ARRAY(peek(2))) {
+          ObjectFloat64Array* array = AS_FLOAT64_ARRAY(peek(2));
+          if (!checkIndex(peek(1), array->length, &index)) return INTERPRET_RUNTIME_ERROR;
+
+          if (!IS_NUMERIC(peek(0))) {
+            runtimeError("Float64Array items must be numbers");
+            return INTERPRET_RUNTIME_ERROR;
+          }
+          array->values[index] = AS_NUMERIC(peek(0));
+        } else if (IS_MAP(peek(2))) {
+          if (!checkMapKey(&vm.stackTop[-2])) return INTERPRET_RUNTIME_ERROR;
+          mapSet(&AS_MAP(peek(2))->map, peek(1), peek(0));
+        } else {
+          runtimeError("Only lists, arrays and maps can be indexed");
+          return INTERPRET_RUNTIME_ERROR;
+        }
+
+        Value value = pop();
+        vm.stackTop -= 2;
+        push(value);
+        break;
+      }
+      case OP_GET_INDEX: {
+        int index;
+        Value value;
+
+        if (IS_LIST(peek(1))) {
+          ObjectList* list = AS_LIST(peek(1));
+          if (!checkIndex(peek(0), list->items.count, &index)) return INTERPRET_RUNTIME_ERROR;
+
+          value = list->items.values[index];
+        } else if (IS_FLOAT64_ARRAY(peek(1))) {
+          ObjectFloat64Array* array = AS_FLOAT64_ARRAY(peek(1));
+          if (!checkIndex(peek(0), array->length, &index)) return INTERPRET_RUNTIME_ERROR;
+
+          value = NUMBER_VAL(array->values[index]);
+        } else if (IS_MAP(peek(1))) {
+          if (!checkMapKey(&vm.stackTop[-1])) return INTERPRET_RUNTIME_ERROR;
+          if (!mapGet(&AS_MAP(peek(1))->map, peek(0), &value)) {
+            runtimeError("Key not found in map");
+            return INTERPRET_RUNTIME_ERROR;
+          }
+        } else {
+          runtimeError("Only lists, arrays and maps can be indexed");
+          return INTERPRET_RUNTIME_ERROR;
+        }
+
+        vm.stackTop -= 2;
+        push(value);
+        break;
+      }
       case OP_EQUAL:
-        Value b = pop();
-        Value a = pop();
-        push(BOOL_VAL(valuesEqual(a, b)));
+        bool equal = valuesEqual(peek(1), peek(0));
+        pop();
+        pop();
+        push(BOOL_VAL(equal));
         break;
       case OP_GREATER:
-        BINARY_OP(BOOL_VAL, >);
+        COMPARISON_OP(b, a);
         break;
       case OP_LESS:
-        BINARY_OP(BOOL_VAL, <);
+        COMPARISON_OP(a, b);
         break;
       case OP_ADD:
-        if (IS_STRING(peek(0)) && IS_STRING(peek(1))) {
+        if (IS_NUMERIC(peek(0)) && IS_NUMERIC(peek(1))) {
+          ARITHMETIC_OP(__builtin_add_overflow, +);
+        } else if (IS_STRING_LIKE(peek(0)) && IS_STRING_LIKE(peek(1))) {
           concatenate();
-        } else if (IS_NUMBER(peek(0)) && IS_NUMBER(peek(1))) {
-          double b = AS_NUMBER(pop());
-          double a = AS_NUMBER(pop());
-          push(NUMBER_VAL(a + b));
         } else {
           runtimeError("Operands must be of equal type");
           return INTERPRET_RUNTIME_ERROR;
         }
         break;
       case OP_SUBTRACT:
-        BINARY_OP(NUMBER_VAL, -);
+        ARITHMETIC_OP(__builtin_sub_overflow, -);
         break;
       case OP_MULTIPLY:
-        BINARY_OP(NUMBER_VAL, *);
+        ARITHMETIC_OP(__builtin_mul_overflow, *);
         break;
-      case OP_DIVIDE:
-        BINARY_OP(NUMBER_VAL, /);
+      case OP_DIVIDE: {
+        if (!IS_NUMERIC(peek(0)) || !IS_NUMERIC(peek(1))) {
+          runtimeError("Operands must be numbers.");
+          return INTERPRET_RUNTIME_ERROR;
+        }
+        Value b = pop();
+        Value a = pop();
+        push(NUMBER_VAL(AS_NUMERIC(a) / AS_NUMERIC(b)));
         break;
+      }
+      case OP_INTEGER_DIVIDE: {
+        if (!IS_NUMERIC(peek(0)) || !IS_NUMERIC(peek(1))) {
+          runtimeError("Operands must be numbers.");
+          return INTERPRET_RUNTIME_ERROR;
+        }
+
+        Value b = pop();
+        Value a = pop();
+        if (AS_NUMERIC(b) == 0) {
+          runtimeError("Division by zero");
+          return INTERPRET_RUNTIME_ERROR;
+        }
+
+        if (IS_INTEGER(a) && IS_INTEGER(b) && !(AS_INTEGER(a) == INT64_MIN && AS_INTEGER(b) == -1)) {
+          push(INTEGER_VAL(AS_INTEGER(a) / AS_INTEGER(b)));
+          break;
+        }
+
+        int64_t quotient;
+        double exact = AS_NUMERIC(a) / AS_NUMERIC(b);
+        if (!integerFromNumber(trunc(exact), &quotient)) {
+          runtimeError("Integer division result out of range");
+          return INTERPRET_RUNTIME_ERROR;
+        }
+        push(INTEGER_VAL(quotient));
+        break;
+      }
+      case OP_MODULO: {
+        if (!IS_NUMERIC(peek(0)) || !IS_NUMERIC(peek(1))) {
+          runtimeError("Operands must be numbers.");
+          return INTERPRET_RUNTIME_ERROR;
+        }
+
+        Value b = pop();
+        Value a = pop();
+        if (IS_INTEGER(a) && IS_INTEGER(b)) {
+          if (AS_INTEGER(b) == 0) {
+            runtimeError("Division by zero");
+            return INTERPRET_RUNTIME_ERROR;
+          }
+
+          // x % -1 is always 0, and INT64_MIN % -1 would trap.
+          push(INTEGER_VAL(AS_INTEGER(b) == -1 ? 0 : AS_INTEGER(a) % AS_INTEGER(b)));
+          break;
+        }
+
+        push(NUMBER_VAL(fmod(AS_NUMERIC(a), AS_NUMERIC(b))));
+        break;
+      }
+      case OP_BIT_AND:
+        BITWISE_OP(&);
+        break;
+      case OP_BIT_OR:
+        BITWISE_OP(|);
+        break;
+      case OP_BIT_XOR:
+        BITWISE_OP(^);
+        break;
+      case OP_SHIFT_LEFT:
+      case OP_SHIFT_RIGHT: {
+        if (!IS_INTEGER(peek(0)) || !IS_INTEGER(peek(1))) {
+          runtimeError("Operands must be integers");
+          return INTERPRET_RUNTIME_ERROR;
+        }
+
+        int64_t count = AS_INTEGER(pop());
+        int64_t value = AS_INTEGER(pop());
+        if (count < 0 || count > 63) {
+          runtimeError("Shift count must be between 0 and 63");
+          return INTERPRET_RUNTIME_ERROR;
+        }
+
+        // Left shifts wrap; right shifts are arithmetic.
+        if (instruction == OP_SHIFT_LEFT) {
+          push(INTEGER_VAL((int64_t)((uint64_t)value << count)));
+        } else {
+          push(INTEGER_VAL(value >> count));
+        }
+        break;
+      }
       case OP_NOT:
         push(BOOL_VAL(isFalse(pop())));
         break;
       case OP_NEGATE:
-        if (!IS_NUMBER(peek(0))) {
+        if (IS_INTEGER(peek(0)) && AS_INTEGER(peek(0)) != INT64_MIN) {
+          push(INTEGER_VAL(-AS_INTEGER(pop())));
+          break;
+        }
+
+        if (!IS_NUMERIC(peek(0))) {
           runtimeError("Operand must be a number");
           return INTERPRET_RUNTIME_ERROR;
         }
-        push(NUMBER_VAL(-AS_NUMBER(pop())));
+        Value operand = pop();
+        push(NUMBER_VAL(-AS_NUMERIC(operand)));
+        break;
+      case OP_BIT_NOT:
+        if (!IS_INTEGER(peek(0))) {
+          runtimeError("Operand must be an integer");
+          return INTERPRET_RUNTIME_ERROR;
+        }
+        push(INTEGER_VAL(~AS_INTEGER(pop())));
         break;
       case OP_PRINT:
         printValue(pop());
-        printf("\n");
+        WRITE_LITERAL(&vm.output, "\n");
         break;
       case OP_JUMP: {
         uint16_t offset = READ_SHORT();
@@ -375,9 +744,12 @@ static InterpretResult run() {
         uint16_t offset = READ_SHORT();
         
         frame->ip -= offset;
+        if (vm.shouldCompact) compactHeap();
         break;
       }
       case OP_CALL: {
+        if (vm.shouldCompact) compactHeap();
+
         int argCount = READ_BYTE();
         if (!callValue(peek(argCount), argCount)) {
           return INTERPRET_RUNTIME_ERROR;
@@ -424,6 +796,19 @@ static InterpretResult run() {
       case OP_CLASS:
         push(OBJECT_VAL(newClass(READ_STRING())));
         break;
+      case OP_BUILD_LIST: {
+        int itemCount = READ_BYTE();
+        ObjectList* list = newList();
+        push(OBJECT_VAL(list));
+
+        for (int i = itemCount; i > 0; i--) {
+          writeValueArray(&list->items, peek(i));
+        }
+
+        vm.stackTop -= itemCount + 1;
+        push(OBJECT_VAL(list));
+        break;
+      }
     }
   }
 
@@ -431,12 +816,28 @@ static InterpretResult run() {
   #undef READ_CONSTANT
   #undef READ_SHORT
   #undef READ_STRING
-  #undef BINARY_OP
+  #undef ARITHMETIC_OP
+  #undef COMPARISON_OP
+  #undef BITWISE_OP
 }
 
-InterpretResult interpret(const char* source) {
-  ObjectFunction* function = compile(source);
-  if (function == NULL) return INTERPRET_COMPILE_ERROR;
+// Compiles and runs length bytes of script, taking ownership of the buffer
+// (see newSource()).
+InterpretResult interpretSource(char* chars, int length, bool mapped) {
+  jmp_buf handler;
+  if (setjmp(handler) != 0) {
+    vm.errorHandler = NULL;
+    resetCompiler();
+    return INTERPRET_RUNTIME_ERROR;
+  }
+
+  vm.errorHandler = &handler;
+
+  ObjectFunction* function = compile(newSource(chars, length, mapped));
+  if (function == NULL) {
+    vm.errorHandler = NULL;
+    return INTERPRET_COMPILE_ERROR;
+  }
 
   push(OBJECT_VAL(function));
   ObjectClosure* closure = newClosure(function);
@@ -444,5 +845,19 @@ InterpretResult interpret(const char* source) {
   push(OBJECT_VAL(closure));
   call(closure, 0);
 
-  return run();
+  InterpretResult result = run();
+  vm.errorHandler = NULL;
+  return result;
+}
+
+InterpretResult interpret(const char* source) {
+  size_t length = strlen(source);
+  char* chars = (char*)malloc(length + 1);
+  if (chars == NULL) {
+    fprintf(stderr, "Out of memory: could not copy the script\n");
+    return INTERPRET_RUNTIME_ERROR;
+  }
+
+  memcpy(chars, source, length);
+  return interpretSource(chars, (int)length, false);
 }
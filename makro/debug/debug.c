@@ -5,8 +5,8 @@
 #include "../include/debug.h"
 #include "../include/object.h"
 
-void disassembleChunk(Chunk *chunk, const char *name) {
-  printf("== %s ==\n", name);
+void disassembleChunk(Chunk *chunk, const char *name, int length) {
+  printf("== %.*s ==\n", length, name);
 
   for (int offset = 0; offset < chunk->count;) {
     offset = disassembleInstruction(chunk, offset);
@@ -81,6 +81,10 @@ int disassembleInstruction(Chunk* chunk, int offset) {
       return constantInstruction("OP_SET_PROPERTY", chunk, offset);
     case OP_GET_PROPERTY:
       return constantInstruction("OP_GET_PROPERTY", chunk, offset);
+    case OP_SET_INDEX:
+      return simpleInstruction("OP_SET_INDEX", offset);
+    case OP_GET_INDEX:
+      return simpleInstruction("OP_GET_INDEX", offset);
     case OP_EQUAL:
       return simpleInstruction("OP_EQUAL", offset);
     case OP_GREATER:
@@ -95,10 +99,26 @@ int disassembleInstruction(Chunk* chunk, int offset) {
       return simpleInstruction("OP_MULTIPLY", offset);
     case OP_DIVIDE:
       return simpleInstruction("OP_DIVIDE", offset);
+    case OP_INTEGER_DIVIDE:
+      return simpleInstruction("OP_INTEGER_DIVIDE", offset);
+    case OP_MODULO:
+      return simpleInstruction("OP_MODULO", offset);
+    case OP_BIT_AND:
+      return simpleInstruction("OP_BIT_AND", offset);
+    case OP_BIT_OR:
+      return simpleInstruction("OP_BIT_OR", offset);
+    case OP_BIT_XOR:
+      return simpleInstruction("OP_BIT_XOR", offset);
+    case OP_SHIFT_LEFT:
+      return simpleInstruction("OP_SHIFT_LEFT", offset);
+    case OP_SHIFT_RIGHT:
+      return simpleInstruction("OP_SHIFT_RIGHT", offset);
     case OP_NOT:
       return simpleInstruction("OP_NOT", offset);
     case OP_NEGATE:
       return simpleInstruction("OP_NEGATE", offset);
+    case OP_BIT_NOT:
+      return simpleInstruction("OP_BIT_NOT", offset);
     case OP_PRINT:
       return simpleInstruction("OP_PRINT", offset);
     case OP_JUMP:
@@ -131,6 +151,8 @@ int disassembleInstruction(Chunk* chunk, int offset) {
       return simpleInstruction("OP_RETURN", offset);
     case OP_CLASS:
       return constantInstruction("OP CLASS", chunk, offset);
+    case OP_BUILD_LIST:
+      return byteInstruction("OP_BUILD_LIST", chunk, offset);
     default:
       printf("Unknown OPCode %d\n", instruction);
       return offset + 1;
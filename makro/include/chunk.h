@@ -19,6 +19,8 @@ typedef enum {
   OP_GET_UPVALUE,
   OP_SET_PROPERTY,
   OP_GET_PROPERTY,
+  OP_SET_INDEX,
+  OP_GET_INDEX,
   OP_EQUAL,
   OP_GREATER,
   OP_LESS,
@@ -26,8 +28,16 @@ typedef enum {
   OP_SUBTRACT,
   OP_MULTIPLY,
   OP_DIVIDE,
+  OP_INTEGER_DIVIDE,
+  OP_MODULO,
+  OP_BIT_AND,
+  OP_BIT_OR,
+  OP_BIT_XOR,
+  OP_SHIFT_LEFT,
+  OP_SHIFT_RIGHT,
   OP_NOT,
   OP_NEGATE,
+  OP_BIT_NOT,
   OP_PRINT,
   OP_JUMP,
   OP_JUMP_IF_FALSE,
@@ -36,7 +46,8 @@ typedef enum {
   OP_CLOSURE,
   OP_CLOSE_UPVALUE,
   OP_RETURN,
-  OP_CLASS
+  OP_CLASS,
+  OP_BUILD_LIST
 } OPCode;
 
 typedef struct {
@@ -5,11 +5,15 @@
 #include <stddef.h>
 #include <stdint.h>
 
+// Debug builds (make debug) compile in the diagnostic hooks below; each is
+// still switched on at runtime. Release builds leave them out entirely.
+#ifdef MAKRO_DEBUG
 #define DEBUG_PRINT_CODE
 #define DEBUG_TRACE_EXECUTION
 
 #define DEBUG_STRESS_GARBAGE_COLLECT
 #define DEBUG_LOG_GARBAGE_COLLECT
+#endif
 
 #define UINT8_COUNT (UINT8_MAX + 1)
 
@@ -4,7 +4,8 @@
 #include "object.h"
 #include "vm.h"
 
-ObjectFunction* compile(const char* source);
+ObjectFunction* compile(ObjectSource* source);
 void markCompilerRoots();
+void resetCompiler();
 
 #endif
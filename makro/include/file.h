@@ -0,0 +1,19 @@
+#ifndef makro_file
+#define makro_file
+
+#include "common.h"
+#include "object.h"
+#include "value.h"
+
+bool readLineSpan(ObjectFile* file, const char** line, size_t* length);
+
+Value openFileNative(int argCount, Value* args);
+Value closeNative(int argCount, Value* args);
+Value readFileNative(int argCount, Value* args);
+Value readLineNative(int argCount, Value* args);
+Value readBytesNative(int argCount, Value* args);
+Value readFloat64sNative(int argCount, Value* args);
+Value writeNative(int argCount, Value* args);
+Value writeFloat64sNative(int argCount, Value* args);
+
+#endif
@@ -0,0 +1,18 @@
+#ifndef makro_float64array
+#define makro_float64array
+
+#include "common.h"
+#include "value.h"
+
+Value float64ArrayNative(int argCount, Value* args);
+Value f64AddNative(int argCount, Value* args);
+Value f64MulNative(int argCount, Value* args);
+Value f64ScaleNative(int argCount, Value* args);
+Value f64SumNative(int argCount, Value* args);
+Value f64DotNative(int argCount, Value* args);
+Value f64MinNative(int argCount, Value* args);
+Value f64MaxNative(int argCount, Value* args);
+Value f64PrefixSumNative(int argCount, Value* args);
+Value f64FillNative(int argCount, Value* args);
+
+#endif
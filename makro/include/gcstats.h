@@ -0,0 +1,9 @@
+#ifndef makro_gcstats
+#define makro_gcstats
+
+#include "common.h"
+#include "value.h"
+
+Value gcStatsNative(int argCount, Value* args);
+
+#endif
@@ -0,0 +1,87 @@
+#ifndef makro_heap
+#define makro_heap
+
+#include "common.h"
+#include "object.h"
+
+#define HEAP_PAGE_SIZE (64 * 1024)
+#define HEAP_GRANULE 8
+#define HEAP_PAGE_GRANULES (HEAP_PAGE_SIZE / HEAP_GRANULE)
+#define HEAP_BITMAP_WORDS (HEAP_PAGE_GRANULES / 64)
+#define HEAP_SIZE_CLASSES 27
+#define HEAP_MIN_CELL 16
+#define HEAP_MAX_CELL 2048
+#define HEAP_LARGE_BUFFER (64 * 1024)
+
+// Objects live in HEAP_PAGE_SIZE aligned pages, each page serving a single
+// cell size. Mark and allocation state is kept in side bitmaps at the start
+// of the page (one bit per granule) so marking never writes to the object.
+typedef struct HeapPage {
+  struct HeapPage* next;
+  struct HeapPage* prev;
+  int sizeClass;
+  int cellCount;
+  int liveCount;
+  bool evacuating;
+  size_t cellSize;
+  size_t mappedSize;
+  uint64_t markBits[HEAP_BITMAP_WORDS];
+  uint64_t allocBits[HEAP_BITMAP_WORDS];
+} HeapPage;
+
+#define HEAP_PAGE_HEADER ((sizeof(HeapPage) + HEAP_GRANULE - 1) & ~(size_t)(HEAP_GRANULE - 1))
+
+typedef struct HeapCell {
+  struct HeapCell* next;
+} HeapCell;
+
+typedef struct {
+  size_t cellSize;
+  HeapPage* pages;
+  HeapPage* sweepCursor;
+  HeapCell* freeList;
+} SizeClass;
+
+typedef struct {
+  SizeClass classes[HEAP_SIZE_CLASSES];
+  HeapPage* largePages;
+  int pageCount;
+  size_t cellBytes;
+  size_t markedBytes;
+} Heap;
+
+#define PAGE_OF(object) ((HeapPage*)((uintptr_t)(object) & ~(uintptr_t)(HEAP_PAGE_SIZE - 1)))
+#define GRANULE_OF(object) (((uintptr_t)(object) & (HEAP_PAGE_SIZE - 1)) / HEAP_GRANULE)
+
+void initHeap(Heap* heap);
+void freeHeap(Heap* heap);
+void* heapAllocate(Heap* heap, size_t size);
+void* heapReallocate(void* pointer, size_t oldSize, size_t newSize);
+void heapClearMarks(Heap* heap);
+void heapBeginSweep(Heap* heap);
+void heapFinishSweep(Heap* heap);
+double heapFragmentation(Heap* heap);
+bool heapEvacuate(Heap* heap);
+void heapReleaseEvacuated(Heap* heap);
+void heapForEachObject(Heap* heap, void (*function)(Object* object));
+
+static inline bool isObjectMarked(Object* object) {
+  size_t granule = GRANULE_OF(object);
+  return (PAGE_OF(object)->markBits[granule / 64] >> (granule % 64)) & 1;
+}
+
+static inline void setObjectMarked(Object* object) {
+  size_t granule = GRANULE_OF(object);
+  PAGE_OF(object)->markBits[granule / 64] |= (uint64_t)1 << (granule % 64);
+}
+
+// During compaction an evacuated cell is flagged GC_FORWARDED and holds
+// the new address of its object just past the header.
+static inline Object* forwardObject(Object* object) {
+  if (object == NULL || !PAGE_OF(object)->evacuating) return object;
+  if (!(object->gcBits & GC_FORWARDED)) return object;
+
+  return ((Object**)object)[1];
+}
+
+#endif
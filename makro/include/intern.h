@@ -0,0 +1,28 @@
+#ifndef makro_intern
+#define makro_intern
+
+#include "common.h"
+#include "object.h"
+
+// Probes compare the inline hash and length first, so a mismatch never
+// has to load the string itself.
+typedef struct {
+  uint32_t hash;
+  int length;
+  ObjectString* string;
+} InternEntry;
+
+typedef struct {
+  int count;
+  int capacity;
+  InternEntry* entries;
+} InternSet;
+
+void initInternSet(InternSet* set);
+void freeInternSet(InternSet* set);
+ObjectString* internSetFind(InternSet* set, const char* chars, int length, uint32_t hash);
+void internSetAdd(InternSet* set, ObjectString* string);
+void internSetSweep(InternSet* set);
+void forwardInternSet(InternSet* set);
+
+#endif
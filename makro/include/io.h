@@ -0,0 +1,9 @@
+#ifndef makro_io
+#define makro_io
+
+#include "common.h"
+#include "value.h"
+
+Value flushNative(int argCount, Value* args);
+
+#endif
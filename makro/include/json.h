@@ -0,0 +1,12 @@
+#ifndef makro_json
+#define makro_json
+
+#include "common.h"
+#include "value.h"
+
+Value jsonParseNative(int argCount, Value* args);
+Value jsonStringifyNative(int argCount, Value* args);
+Value jsonReadNative(int argCount, Value* args);
+Value jsonWriteNative(int argCount, Value* args);
+
+#endif
@@ -1,19 +1,24 @@
 #ifndef makro_lexer
 #define makro_lexer
 
+#include "common.h"
+
 typedef enum {
   // Single-character tokens
   TOKEN_LEFT_PAREN, TOKEN_RIGHT_PAREN,
   TOKEN_LEFT_BRACE, TOKEN_RIGHT_BRACE,
+  TOKEN_LEFT_BRACKET, TOKEN_RIGHT_BRACKET,
   TOKEN_COMMA, TOKEN_DOT, TOKEN_PLUS, TOKEN_MINUS,
   TOKEN_STAR, TOKEN_SLASH, TOKEN_SEMICOLON,
+  TOKEN_PERCENT, TOKEN_AMPERSAND, TOKEN_PIPE, TOKEN_CARET,
   // One or two character tokens
   TOKEN_BANG, TOKEN_BANG_EQUAL,
   TOKEN_EQUAL, TOKEN_EQUAL_EQUAL,
-  TOKEN_GREATER, TOKEN_GREATER_EQUAL,
-  TOKEN_LESS, TOKEN_LESS_EQUAL,
+  TOKEN_GREATER, TOKEN_GREATER_EQUAL, TOKEN_GREATER_GREATER,
+  TOKEN_LESS, TOKEN_LESS_EQUAL, TOKEN_LESS_LESS,
+  TOKEN_TILDE, TOKEN_TILDE_SLASH,
   // Literals
-  TOKEN_IDENTIFIER, TOKEN_STRING, TOKEN_NUMBER,
+  TOKEN_IDENTIFIER, TOKEN_STRING, TOKEN_NUMBER, TOKEN_INTEGER,
   // Keywords
   TOKEN_AND, TOKEN_CLASS, TOKEN_FOR, TOKEN_IF,
   TOKEN_ELSE, TOKEN_TRUE, TOKEN_FALSE, TOKEN_OR,
@@ -23,14 +28,17 @@ typedef enum {
   TOKEN_ERROR, TOKEN_EOF
 } TokenType;
 
+// Identifier and string tokens carry the hash of their name or contents,
+// computed once while scanning.
 typedef struct {
   TokenType type;
   const char* start;
   int length;
   int line;
+  uint32_t hash;
 } Token;
 
-void initLexer(const char* source);
+void initLexer(const char* source, int length);
 Token scanToken();
 
 #endif
@@ -0,0 +1,12 @@
+#ifndef makro_list
+#define makro_list
+
+#include "common.h"
+#include "value.h"
+
+Value appendNative(int argCount, Value* args);
+Value popNative(int argCount, Value* args);
+Value lengthNative(int argCount, Value* args);
+Value sliceNative(int argCount, Value* args);
+
+#endif
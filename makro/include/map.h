@@ -0,0 +1,36 @@
+#ifndef makro_map
+#define makro_map
+
+#include "common.h"
+#include "value.h"
+
+typedef struct {
+  Value key;
+  Value value;
+  uint32_t hash;
+  bool deleted;
+} MapEntry;
+
+// Entries are kept densely in insertion order; index is a power-of-two
+// open-addressing table of positions into entries, twice as large, so
+// iteration walks a flat array and lookups never touch unrelated entries.
+// Deleted entries stay in place until the next rebuild.
+typedef struct {
+  int count;
+  int entryCount;
+  int entryCapacity;
+  MapEntry* entries;
+  int32_t* index;
+} Map;
+
+void initMap(Map* map);
+void freeMap(Map* map);
+bool mapGet(Map* map, Value key, Value* value);
+void mapReserve(Map* map, int count);
+bool mapSet(Map* map, Value key, Value value);
+bool mapDelete(Map* map, Value key);
+void markMap(Map* map);
+void forwardMap(Map* map);
+uint32_t hashValue(Value value);
+
+#endif
@@ -0,0 +1,16 @@
+#ifndef makro_mapnatives
+#define makro_mapnatives
+
+#include "common.h"
+#include "value.h"
+
+Value mapNative(int argCount, Value* args);
+Value mapGetNative(int argCount, Value* args);
+Value mapSetNative(int argCount, Value* args);
+Value mapHasNative(int argCount, Value* args);
+Value mapDeleteNative(int argCount, Value* args);
+Value mapSizeNative(int argCount, Value* args);
+Value mapKeysNative(int argCount, Value* args);
+Value mapValuesNative(int argCount, Value* args);
+
+#endif
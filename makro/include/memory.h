@@ -10,10 +10,46 @@
 #define GROW_ARRAY(type, pointer, oldCount, newCount) (type*)reallocate(pointer, sizeof(type) * (oldCount), sizeof(type) * (newCount))
 #define FREE_ARRAY(type, pointer, oldCount) reallocate(pointer, sizeof(type) * (oldCount), 0)
 
+#define GC_PAUSE_BUCKETS 8
+
+typedef struct {
+  size_t initialThreshold;
+  size_t minThreshold;
+  size_t maxThreshold;
+  size_t heapLimit;
+  double growFactor;
+  double compactFragmentation;
+  bool reportStats;
+} GCConfig;
+
+typedef struct {
+  int collections;
+  int compactions;
+  uint64_t totalPauseNanos;
+  uint64_t maxPauseNanos;
+  int pauseHistogram[GC_PAUSE_BUCKETS];
+  size_t totalAllocated;
+  size_t totalFreed;
+  size_t liveBytes[OBJECT_TYPE_COUNT];
+} GCStats;
+
+void initGCConfig(GCConfig* config);
+bool setGCOption(GCConfig* config, const char* name, const char* value);
+bool parseSize(const char* text, size_t* size);
+void configureGC(const GCConfig* config);
+const char* objectTypeName(ObjectType type);
+const char* pauseBucketName(int bucket);
+void reportGCStats();
+
 void* reallocate(void* pointer, size_t oldSize, size_t newSize);
+void* allocateCell(size_t size);
+void freeObject(Object* object);
+void relocateObject(Object* object, Object* from);
 void markObject(Object* object);
 void markValue(Value value);
+void forwardValue(Value* value);
 void collectGarbage();
+void compactHeap();
 void freeObjects();
 
 #endif
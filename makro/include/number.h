@@ -0,0 +1,17 @@
+#ifndef makro_number
+#define makro_number
+
+#include "common.h"
+
+// Large enough for anything the formatters below produce, plus a NUL.
+#define NUMBER_BUFFER_SIZE 48
+
+// toFixed() and formatFixed() accept at most this many decimals.
+#define FIXED_MAX_DIGITS 20
+
+int formatNumber(double number, char* buffer);
+int formatInteger(int64_t integer, char* buffer);
+int formatFixed(double number, int digits, char* buffer);
+int parseNumber(const char* chars, int length, double* number);
+
+#endif
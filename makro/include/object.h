@@ -4,39 +4,70 @@
 #include "common.h"
 #include "chunk.h"
 #include "value.h"
+#include "map.h"
 #include "table.h"
 
 #define OBJECT_TYPE(value) (AS_OBJECT(value)->type)
 
 #define IS_CLASS(value) isObjectType(value, OBJECT_CLASS)
 #define IS_CLOSURE(value) isObjectType(value, OBJECT_CLOSURE)
+#define IS_FILE(value) isObjectType(value, OBJECT_FILE)
+#define IS_FLOAT64_ARRAY(value) isObjectType(value, OBJECT_FLOAT64_ARRAY)
 #define IS_FUNCTION(value) isObjectType(value, OBJECT_FUNCTION)
 #define IS_INSTANCE(value) isObjectType(value, OBJECT_INSTANCE)
+#define IS_LIST(value) isObjectType(value, OBJECT_LIST)
+#define IS_MAP(value) isObjectType(value, OBJECT_MAP)
 #define IS_NATIVE(value) isObjectType(value, OBJECT_NATIVE)
+#define IS_ROPE(value) isObjectType(value, OBJECT_ROPE)
 #define IS_STRING(value) isObjectType(value, OBJECT_STRING)
+#define IS_STRING_BUILDER(value) isObjectType(value, OBJECT_STRING_BUILDER)
+#define IS_STRING_LIKE(value) (IS_STRING(value) || IS_ROPE(value))
 
 #define AS_CLASS(value) ((ObjectClass*)AS_OBJECT(value))
 #define AS_CLOSURE(value) ((ObjectClosure*)AS_OBJECT(value))
+#define AS_FILE(value) ((ObjectFile*)AS_OBJECT(value))
+#define AS_FLOAT64_ARRAY(value) ((ObjectFloat64Array*)AS_OBJECT(value))
 #define AS_FUNCTION(value) ((ObjectFunction*)AS_OBJECT(value))
 #define AS_INSTANCE(value) ((ObjectInstance*)AS_OBJECT(value))
+#define AS_LIST(value) ((ObjectList*)AS_OBJECT(value))
+#define AS_MAP(value) ((ObjectMap*)AS_OBJECT(value))
 #define AS_NATIVE(value) (((ObjectNative*)AS_OBJECT(value))->function)
+#define AS_ROPE(value) ((ObjectRope*)AS_OBJECT(value))
 #define AS_STRING(value) ((ObjectString*)AS_OBJECT(value))
-#define AS_CSTRING(value) (((ObjectString*)AS_OBJECT(value))->chars)
+#define AS_STRING_BUILDER(value) ((ObjectStringBuilder*)AS_OBJECT(value))
 
 typedef enum {
   OBJECT_CLASS,
   OBJECT_CLOSURE,
+  OBJECT_FILE,
+  OBJECT_FLOAT64_ARRAY,
   OBJECT_FUNCTION,
   OBJECT_INSTANCE,
+  OBJECT_LIST,
+  OBJECT_MAP,
   OBJECT_NATIVE,
+  OBJECT_ROPE,
+  OBJECT_SOURCE,
   OBJECT_STRING,
-  OBJECT_UPVALUE
+  OBJECT_STRING_BUILDER,
+  OBJECT_UPVALUE,
+  OBJECT_TYPE_COUNT
 } ObjectType;
 
+#define GC_FORWARDED 0x01
+#define STRING_HASHED 0x02
+#define STRING_INTERNED 0x04
+#define STRING_BORROWED 0x08
+// Set on objects serialize() has written, and cleared before it returns.
+#define OBJECT_VISITED 0x10
+
+// Every object starts with a single header word holding its type and GC
+// bits (strings also keep their STRING_* flags there). Mark state lives in
+// the page bitmaps and objects are enumerated by walking heap pages, so no
+// per-object mark flag or list link is needed.
 struct Object {
-  ObjectType type;
-  bool isMarked;
-  struct Object* next;
+  uint8_t type;
+  uint8_t gcBits;
 };
 
 typedef struct {
@@ -54,13 +85,52 @@ typedef struct {
   NativeFn function;
 } ObjectNative;
 
+// Strings built at runtime are neither hashed nor interned until something
+// needs it; hash is only valid once STRING_HASHED is set in the header.
+// chars normally points at the inline storage. A STRING_BORROWED string
+// instead points into a buffer owned by another object, kept alive through
+// the pointer stored in place of the storage, and is not NUL-terminated.
+// The owner is a source or, for substring views, an unborrowed string.
 struct ObjectString {
   Object object;
   int length;
-  char* chars;
   uint32_t hash;
+  char* chars;
+  char storage[];
 };
 
+#define STRING_OWNER(string) (*(Object**)(string)->storage)
+
+// Script text compiled by the VM. Literals and identifiers borrow their
+// characters from it instead of copying them. The text is either a malloc()ed
+// buffer or a read-only file mapping, and is not NUL-terminated.
+typedef struct {
+  Object object;
+  int length;
+  bool mapped;
+  char* chars;
+} ObjectSource;
+
+// A deferred concatenation of two strings or ropes. The characters are only
+// materialized when the rope is first flattened, after which the children
+// are dropped and the result is cached in flat.
+typedef struct {
+  Object object;
+  int length;
+  Object* left;
+  Object* right;
+  ObjectString* flat;
+} ObjectRope;
+
+// A growable byte buffer for building text piece by piece. Nothing is
+// hashed or interned until toString() copies the result out.
+typedef struct {
+  Object object;
+  int length;
+  int capacity;
+  char* chars;
+} ObjectStringBuilder;
+
 typedef struct ObjectUpvalue {
   Object object;
   Value* location;
@@ -71,8 +141,8 @@ typedef struct ObjectUpvalue {
 typedef struct {
   Object object;
   ObjectFunction* function;
-  ObjectUpvalue** upvalues;
   int upvalueCount;
+  ObjectUpvalue* upvalues[];
 } ObjectClosure;
 
 typedef struct {
@@ -86,15 +156,65 @@ typedef struct {
   Table fields;
 } ObjectInstance;
 
+typedef struct {
+  Object object;
+  ValueArray items;
+} ObjectList;
+
+typedef struct {
+  Object object;
+  Map map;
+} ObjectMap;
+
+// Unboxed numbers for the bulk kernels in modules/float64. values is a
+// separate buffer so large arrays get their own mapping.
+typedef struct {
+  Object object;
+  int length;
+  double* values;
+} ObjectFloat64Array;
+
+// An open file. Reads are served from input, which read(2) refills a
+// block at a time; writes collect in output. Both buffers live outside the
+// heap, and fd is -1 once the file is closed.
+typedef struct {
+  Object object;
+  int fd;
+  bool readable;
+  bool writable;
+  bool eof;
+  char* input;
+  size_t inputStart;
+  size_t inputEnd;
+  size_t inputCapacity;
+  OutputBuffer output;
+} ObjectFile;
+
 ObjectClass* newClass(ObjectString* name);
 ObjectClosure* newClosure(ObjectFunction* function);
+ObjectFile* newFile();
+ObjectFloat64Array* newFloat64Array(int length);
 ObjectFunction* newFunction();
 ObjectInstance* newInstance(ObjectClass* _class);
+ObjectList* newList();
+ObjectMap* newMap();
 ObjectNative* newNative(NativeFn function);
-ObjectString* takeString(char* chars, int length);
+ObjectRope* newRope(Object* left, Object* right, int length);
+ObjectString* flattenRope(ObjectRope* rope);
+void forEachRopePiece(ObjectRope* rope, void (*visit)(ObjectString* piece, void* context), void* context);
+ObjectSource* newSource(char* chars, int length, bool mapped);
+ObjectString* allocateString(int length);
+ObjectString* borrowString(Object* owner, const char* chars, int length, uint32_t hash);
+ObjectString* newBorrowedString(Object* owner, const char* chars, int length);
+ObjectString* newStringView(ObjectString* parent, int start, int length);
+uint32_t hashString(const char* chars, int length);
+ObjectString* internString(ObjectString* string);
+uint32_t stringHash(ObjectString* string);
+bool stringsEqual(ObjectString* a, ObjectString* b);
 ObjectString* copyString(const char* chars, int length);
+ObjectStringBuilder* newStringBuilder();
 ObjectUpvalue* newUpvalue(Value* slot);
-void printObject(Value value);
+void writeObject(OutputBuffer* output, Value value);
 
 static inline bool isObjectType(Value value, ObjectType type) {
   return IS_OBJECT(value) && AS_OBJECT(value)->type == type;
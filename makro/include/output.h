@@ -0,0 +1,57 @@
+#ifndef makro_output
+#define makro_output
+
+#include <string.h>
+
+#include "common.h"
+
+#define OUTPUT_DEFAULT_SIZE (64 * 1024)
+#define OUTPUT_MEMORY (-1)
+
+// Output to a file descriptor is collected here and handed to write(2) in
+// large batches. Program output is flushed when the buffer fills, on
+// flush(), before a runtime error is reported and at exit. A size of 0
+// writes every piece straight through. The buffer itself is allocated on
+// the first write; failed records a write error until the next flush.
+// With fd set to OUTPUT_MEMORY the buffer instead grows to hold whatever
+// is written, and flushing it just empties it.
+typedef struct {
+  char* bytes;
+  size_t count;
+  size_t capacity;
+  size_t size;
+  int fd;
+  bool failed;
+} OutputBuffer;
+
+void initOutput(OutputBuffer* output, int fd, size_t size);
+void initStandardOutput(OutputBuffer* output);
+void setOutputSize(OutputBuffer* output, size_t size);
+void freeOutput(OutputBuffer* output);
+bool flushOutput(OutputBuffer* output);
+void writeOutputSlow(OutputBuffer* output, const char* bytes, size_t length);
+char* reserveOutputSlow(OutputBuffer* output, size_t length);
+
+// An empty write returns at once: the buffer, or bytes, may not exist yet.
+static inline void writeOutput(OutputBuffer* output, const char* bytes, size_t length) {
+  if (length == 0) return;
+
+  if (length <= output->capacity - output->count) {
+    memcpy(output->bytes + output->count, bytes, length);
+    output->count += length;
+    return;
+  }
+
+  writeOutputSlow(output, bytes, length);
+}
+
+#define WRITE_LITERAL(output, text) writeOutput(output, text, sizeof(text) - 1)
+
+// Returns room for at least length bytes at the end of the buffer, or NULL
+// if the buffer is smaller than that. The caller adds what it used to count.
+static inline char* reserveOutput(OutputBuffer* output, size_t length) {
+  if (length <= output->capacity - output->count) return output->bytes + output->count;
+  return reserveOutputSlow(output, length);
+}
+
+#endif
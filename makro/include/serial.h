@@ -0,0 +1,10 @@
+#ifndef makro_serial
+#define makro_serial
+
+#include "common.h"
+#include "value.h"
+
+Value serializeNative(int argCount, Value* args);
+Value deserializeNative(int argCount, Value* args);
+
+#endif
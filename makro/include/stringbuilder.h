@@ -0,0 +1,14 @@
+#ifndef makro_stringbuilder
+#define makro_stringbuilder
+
+#include "common.h"
+#include "object.h"
+#include "value.h"
+
+void builderAppend(ObjectStringBuilder* builder, const char* chars, int length);
+
+Value stringBuilderNative(int argCount, Value* args);
+Value appendNumberNative(int argCount, Value* args);
+Value toStringNative(int argCount, Value* args);
+
+#endif
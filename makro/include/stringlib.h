@@ -0,0 +1,18 @@
+#ifndef makro_stringlib
+#define makro_stringlib
+
+#include "common.h"
+#include "value.h"
+
+Value indexOfNative(int argCount, Value* args);
+Value containsNative(int argCount, Value* args);
+Value startsWithNative(int argCount, Value* args);
+Value endsWithNative(int argCount, Value* args);
+Value substringNative(int argCount, Value* args);
+Value trimNative(int argCount, Value* args);
+Value splitNative(int argCount, Value* args);
+Value joinNative(int argCount, Value* args);
+Value replaceNative(int argCount, Value* args);
+Value toFixedNative(int argCount, Value* args);
+
+#endif
@@ -9,20 +9,26 @@ typedef struct {
   Value value;
 } Entry;
 
+// Empty and deleted slots have a NULL key, so walking entries[0..capacity)
+// and skipping NULL keys visits every live entry. control points just past
+// the entries, in the same allocation.
 typedef struct {
   int count;
+  int tombstones;
   int capacity;
   Entry* entries;
+  uint8_t* control;
 } Table;
 
 void initTable(Table* table);
 void freeTable(Table* table);
+// Keys must be interned (see internString()).
+void tableReserve(Table* table, int count);
 bool tableSet(Table* table, ObjectString* key, Value value);
 bool tableGet(Table* table, ObjectString* key, Value* value);
 bool tableDelete(Table* table, ObjectString* key);
 void tableAddAll(Table* from, Table* to);
-ObjectString* tableFindString(Table* table, const char* chars, int length, uint32_t hash);
-void tableRemoveWhite(Table* table);
 void markTable(Table* table);
+void forwardTable(Table* table);
 
 #endif
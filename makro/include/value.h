@@ -2,6 +2,7 @@
 #define makro_value
 
 #include "common.h"
+#include "output.h"
 
 typedef struct Object Object;
 typedef struct ObjectString ObjectString;
@@ -9,6 +10,7 @@ typedef struct ObjectString ObjectString;
 
 typedef enum {
   VAL_BOOL,
+  VAL_INTEGER,
   VAL_NULL,
   VAL_NUMBER,
   VAL_OBJECT
@@ -18,21 +20,30 @@ typedef struct {
   ValueType type;
   union {
     bool boolean;
+    int64_t integer;
     double number;
     Object* object;
   } as;
 } Value;
 
 #define IS_BOOL(value) ((value).type == VAL_BOOL)
+#define IS_INTEGER(value) ((value).type == VAL_INTEGER)
 #define IS_NULL(value) ((value).type == VAL_NULL)
 #define IS_NUMBER(value) ((value).type == VAL_NUMBER)
 #define IS_OBJECT(value) ((value).type == VAL_OBJECT)
 
+// Integers and doubles are both numbers to scripts. Arithmetic on two
+// integers stays integral until it overflows; anything mixed is a double.
+#define IS_NUMERIC(value) (IS_NUMBER(value) || IS_INTEGER(value))
+
 #define AS_OBJECT(value) ((value).as.object)
 #define AS_BOOL(value) ((value).as.boolean)
+#define AS_INTEGER(value) ((value).as.integer)
 #define AS_NUMBER(value) ((value).as.number)
+#define AS_NUMERIC(value) (IS_INTEGER(value) ? (double)AS_INTEGER(value) : AS_NUMBER(value))
 
 #define BOOL_VAL(value) ((Value){VAL_BOOL, {.boolean = value}})
+#define INTEGER_VAL(value) ((Value){VAL_INTEGER, {.integer = value}})
 #define NULL_VAL ((Value){VAL_NULL, {.number = 0}})
 #define NUMBER_VAL(value) ((Value){VAL_NUMBER, {.number = value}})
 #define OBJECT_VAL(obj) ((Value){VAL_OBJECT, {.object = (Object*)obj}})
@@ -44,9 +55,13 @@ typedef struct {
 } ValueArray;
 
 bool valuesEqual(Value a, Value b);
+bool valuesLess(Value a, Value b);
 void initValueArray(ValueArray* array);
 void writeValueArray(ValueArray* array, Value value);
+void reserveValueArray(ValueArray* array, int capacity);
 void freeValueArray(ValueArray* array);
+bool integerFromNumber(double number, int64_t* integer);
+void writeValue(OutputBuffer* output, Value value);
 void printValue(Value value);
 
 #endif
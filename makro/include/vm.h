@@ -1,12 +1,19 @@
 #ifndef makro_vm
 #define makro_vm
 
+#include <setjmp.h>
+
+#include "heap.h"
+#include "intern.h"
+#include "memory.h"
 #include "object.h"
+#include "output.h"
 #include "value.h"
 #include "table.h"
 
 #define FRAME_MAX 64
 #define STACK_MAX (FRAME_MAX + UINT8_COUNT)
+#define ROPE_MIN_LENGTH 64
 
 typedef struct {
   ObjectClosure* closure;
@@ -14,6 +21,13 @@ typedef struct {
   Value* slots;
 } CallFrame;
 
+typedef struct {
+  bool printCode;
+  bool traceExecution;
+  bool stressGC;
+  bool logGC;
+} DebugOptions;
+
 typedef struct {
   CallFrame frames[FRAME_MAX];
   int frameCount;
@@ -21,12 +35,19 @@ typedef struct {
   Value stack[STACK_MAX];
   Value* stackTop;
   Table globals;
-  Table strings;
+  ObjectClass* jsonClass;
+  InternSet strings;
   ObjectUpvalue* openUpvalues;
   
   size_t bytesAllocated;
   size_t nextGC;
-  Object* objects;
+  bool shouldCompact;
+  GCConfig gcConfig;
+  GCStats gcStats;
+  jmp_buf* errorHandler;
+  OutputBuffer output;
+  DebugOptions debug;
+  Heap heap;
   int grayCount;
   int grayCapacity;
   Object** grayStack;
@@ -44,7 +65,10 @@ void initVM();
 void freeVM();
 
 InterpretResult interpret(const char* source);
+InterpretResult interpretSource(char* chars, int length, bool mapped);
 
+_Noreturn void throwRuntimeError(const char* format, ...);
+_Noreturn void rethrowRuntimeError(jmp_buf* handler);
 void push(Value value);
 Value pop();
 
@@ -1,6 +1,11 @@
+#include <fcntl.h>
+#include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #include "include/common.h"
 #include "include/chunk.h"
@@ -19,57 +24,182 @@ static void repl() {
     }
 
     interpret(line);
+    flushOutput(&vm.output);
   }
 }
 
-static char* readFile(const char* path) {
-  FILE* file = fopen(path, "rb");
-  if (file == NULL) {
-    fprintf(stderr, "Could not open file \"%s\".\n", path);
-    exit(74);
-  }
+typedef struct {
+  char* chars;
+  size_t length;
+  bool mapped;
+} SourceFile;
+
+static void readFailed(const char* message, const char* path) {
+  fprintf(stderr, "%s \"%s\".\n", message, path);
+  exit(74);
+}
+
+// Fallback for files that cannot be mapped, such as pipes.
+static SourceFile readFile(int fd, const char* path) {
+  SourceFile file = { NULL, 0, false };
+  size_t capacity = 0;
 
-  fseek(file, 0L, SEEK_END);
-  size_t fileSize = ftell(file);
-  rewind(file);
+  for (;;) {
+    if (file.length == capacity) {
+      capacity = capacity < 4096 ? 4096 : capacity * 2;
+      file.chars = (char*)realloc(file.chars, capacity);
+      if (file.chars == NULL) readFailed("Not enough memory to read", path);
+    }
 
-  char* buffer = (char*)malloc(fileSize + 1);
-  if (buffer == NULL) {
-    fprintf(stderr, "Not enough memory to read \"%s\".\n", path);
-    exit(74);
+    ssize_t bytesRead = read(fd, file.chars + file.length, capacity - file.length);
+    if (bytesRead < 0) readFailed("Could not read file", path);
+    if (bytesRead == 0) break;
+
+    file.length += (size_t)bytesRead;
   }
 
-  size_t bytesRead = fread(buffer, sizeof(char), fileSize, file);
-  if (bytesRead < fileSize) {
-    fprintf(stderr, "Could not read file \"%s\".\n", path);
-    exit(74);
+  return file;
+}
+
+// Maps the script read-only instead of copying it into the heap. The lexer
+// works on a (pointer, length) span, so no terminating NUL is needed.
+static SourceFile loadFile(const char* path) {
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) readFailed("Could not open file", path);
+
+  SourceFile file = { NULL, 0, false };
+  struct stat info;
+
+  if (fstat(fd, &info) == 0 && S_ISREG(info.st_mode) && info.st_size > 0) {
+    void* chars = mmap(NULL, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (chars != MAP_FAILED) {
+      madvise(chars, (size_t)info.st_size, MADV_SEQUENTIAL);
+      file.chars = (char*)chars;
+      file.length = (size_t)info.st_size;
+      file.mapped = true;
+    }
   }
 
-  buffer[bytesRead] = '\0';
+  if (!file.mapped) file = readFile(fd, path);
+  close(fd);
 
-  fclose(file);
-  return buffer;
+  if (file.length > INT_MAX) readFailed("Script is too large", path);
+  return file;
 }
 
 static void runFile(const char* path) {
-  char* source = readFile(path);
-  InterpretResult result = interpret(source);
-  free(source);
+  SourceFile file = loadFile(path);
+  InterpretResult result = interpretSource(file.chars, (int)file.length, file.mapped);
+
+  if (result == INTERPRET_COMPILE_ERROR) {
+    freeVM();
+    exit(65);
+  }
+
+  if (result == INTERPRET_RUNTIME_ERROR) {
+    freeVM();
+    exit(70);
+  }
+}
+
+static void usage() {
+  fprintf(stderr, "Usage: makro [options] [path]\n");
+  fprintf(stderr, "  --gc-initial=SIZE     heap size that triggers the first collection\n");
+  fprintf(stderr, "  --gc-min=SIZE         least room to allocate between collections\n");
+  fprintf(stderr, "  --gc-max=SIZE         most room to allocate between collections (not a heap limit)\n");
+  fprintf(stderr, "  --gc-limit=SIZE       hard heap limit; exceeding it is a runtime error\n");
+  fprintf(stderr, "  --gc-growth=FACTOR    threshold multiplier applied to live bytes\n");
+  fprintf(stderr, "  --gc-compact=RATIO    fragmentation that triggers compaction (0 disables)\n");
+  fprintf(stderr, "  --gc-stats            print collector statistics on exit\n");
+  fprintf(stderr, "  --output-buffer=SIZE  bytes of output buffered between writes (0 disables)\n");
+
+  #ifdef MAKRO_DEBUG
+    fprintf(stderr, "  --print-code          disassemble each function after compiling it\n");
+    fprintf(stderr, "  --trace               trace the stack and every executed instruction\n");
+    fprintf(stderr, "  --stress-gc           collect garbage on every allocation\n");
+    fprintf(stderr, "  --log-gc              log every collector action\n");
+  #endif
+
+  exit(64);
+}
+
+static bool parseDebugOption(const char* option) {
+  #ifdef MAKRO_DEBUG
+    bool* flag = NULL;
+    if (strcmp(option, "--print-code") == 0) flag = &vm.debug.printCode;
+    if (strcmp(option, "--trace") == 0) flag = &vm.debug.traceExecution;
+    if (strcmp(option, "--stress-gc") == 0) flag = &vm.debug.stressGC;
+    if (strcmp(option, "--log-gc") == 0) flag = &vm.debug.logGC;
+
+    if (flag != NULL) {
+      *flag = true;
+      return true;
+    }
+  #endif
+
+  return false;
+}
+
+static bool parseOutputOption(const char* option) {
+  const char* prefix = "--output-buffer=";
+  if (strncmp(option, prefix, strlen(prefix)) != 0) return false;
+
+  size_t size;
+  if (!parseSize(option + strlen(prefix), &size)) {
+    fprintf(stderr, "Invalid option \"%s\".\n", option);
+    usage();
+  }
 
-  if (result == INTERPRET_COMPILE_ERROR) exit(65);
-  if (result == INTERPRET_RUNTIME_ERROR) exit(70);
+  setOutputSize(&vm.output, size);
+  return true;
+}
+
+// Parses --gc-NAME[=VALUE] options into config, --output-buffer, and debug
+// switches when built with MAKRO_DEBUG, returning the index of the first
+// non-option.
+static int parseOptions(int argc, const char* argv[], GCConfig* config) {
+  int i = 1;
+  for (; i < argc && strncmp(argv[i], "--", 2) == 0; i++) {
+    if (parseDebugOption(argv[i]) || parseOutputOption(argv[i])) continue;
+    if (strncmp(argv[i], "--gc-", 5) != 0) usage();
+
+    char name[32];
+    const char* option = argv[i] + 5;
+    const char* value = strchr(option, '=');
+    size_t length = value != NULL ? (size_t)(value - option) : strlen(option);
+    if (length >= sizeof(name)) usage();
+
+    memcpy(name, option, length);
+    name[length] = '\0';
+
+    if (!setGCOption(config, name, value != NULL ? value + 1 : NULL)) {
+      fprintf(stderr, "Invalid option \"%s\".\n", argv[i]);
+      usage();
+    }
+  }
+
+  return i;
 }
 
 int main(int argc, const char* argv[]) {
   initVM();
 
-  if (argc == 1) {
+  GCConfig config = vm.gcConfig;
+  int first = parseOptions(argc, argv, &config);
+  configureGC(&config);
+
+  // Diagnostics go through stdio, so program output is written through
+  // unbuffered to keep the two in order.
+  if (vm.debug.printCode || vm.debug.traceExecution || vm.debug.logGC) {
+    setOutputSize(&vm.output, 0);
+  }
+
+  if (first == argc) {
     repl();
-  } else if (argc == 2) {
-    runFile(argv[1]);
+  } else if (first == argc - 1) {
+    runFile(argv[first]);
   } else {
-    fprintf(stderr, "Usage: makro [path]");
-    exit(64);
+    usage();
   }
 
   freeVM();
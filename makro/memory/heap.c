@@ -0,0 +1,579 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "../include/heap.h"
+#include "../include/memory.h"
+#include "../include/vm.h"
+
+static const size_t cellSizes[HEAP_SIZE_CLASSES] = {
+  16, 24, 32, 40, 48, 56, 64,
+  80, 96, 112, 128,
+  160, 192, 224, 256,
+  320, 384, 448, 512,
+  640, 768, 896, 1024,
+  1280, 1536, 1792, 2048
+};
+
+static uint8_t sizeClassIndex[HEAP_MAX_CELL / HEAP_GRANULE + 1];
+static size_t osPageSize;
+
+void initHeap(Heap* heap) {
+  osPageSize = (size_t)sysconf(_SC_PAGESIZE);
+
+  int sizeClass = 0;
+  for (int i = 0; i <= HEAP_MAX_CELL / HEAP_GRANULE; i++) {
+    while (cellSizes[sizeClass] < (size_t)i * HEAP_GRANULE) sizeClass++;
+    sizeClassIndex[i] = (uint8_t)sizeClass;
+  }
+
+  for (int i = 0; i < HEAP_SIZE_CLASSES; i++) {
+    heap->classes[i].cellSize = cellSizes[i];
+    heap->classes[i].pages = NULL;
+    heap->classes[i].sweepCursor = NULL;
+    heap->classes[i].freeList = NULL;
+  }
+
+  heap->largePages = NULL;
+  heap->pageCount = 0;
+  heap->cellBytes = 0;
+  heap->markedBytes = 0;
+}
+
+static inline bool testBit(uint64_t* bits, size_t granule) {
+  return (bits[granule / 64] >> (granule % 64)) & 1;
+}
+
+static inline void setBit(uint64_t* bits, size_t granule) {
+  bits[granule / 64] |= (uint64_t)1 << (granule % 64);
+}
+
+static inline void clearBit(uint64_t* bits, size_t granule) {
+  bits[granule / 64] &= ~((uint64_t)1 << (granule % 64));
+}
+
+// Pages are mapped straight from the OS so that releasing one after a sweep
+// or a compaction actually shrinks the resident set.
+static void* mapAligned(size_t size) {
+  size_t padded = size + HEAP_PAGE_SIZE;
+  char* base = mmap(NULL, padded, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (base == MAP_FAILED) return NULL;
+
+  uintptr_t aligned = ((uintptr_t)base + HEAP_PAGE_SIZE - 1) & ~(uintptr_t)(HEAP_PAGE_SIZE - 1);
+  size_t head = aligned - (uintptr_t)base;
+  size_t tail = padded - head - size;
+
+  if (head > 0) munmap(base, head);
+  if (tail > 0) munmap((char*)aligned + size, tail);
+  return (void*)aligned;
+}
+
+static void releasePage(HeapPage* page) {
+  munmap(page, page->mappedSize);
+}
+
+static HeapPage* newPage(size_t mappedSize, int sizeClass, size_t cellSize) {
+  HeapPage* page = (HeapPage*)mapAligned(mappedSize);
+  if (page == NULL) return NULL;
+
+  page->next = NULL;
+  page->prev = NULL;
+  page->liveCount = 0;
+  page->evacuating = false;
+  page->sizeClass = sizeClass;
+  page->cellSize = cellSize;
+  page->mappedSize = mappedSize;
+  page->cellCount = sizeClass < 0 ? 1 : (int)((HEAP_PAGE_SIZE - HEAP_PAGE_HEADER) / cellSize);
+  memset(page->markBits, 0, sizeof(page->markBits));
+  memset(page->allocBits, 0, sizeof(page->allocBits));
+  return page;
+}
+
+static void linkPage(HeapPage** list, HeapPage* page) {
+  page->prev = NULL;
+  page->next = *list;
+  if (*list != NULL) (*list)->prev = page;
+  *list = page;
+}
+
+static void unlinkPage(HeapPage** list, HeapPage* page) {
+  if (page->prev != NULL) {
+    page->prev->next = page->next;
+  } else {
+    *list = page->next;
+  }
+
+  if (page->next != NULL) page->next->prev = page->prev;
+}
+
+static inline Object* cellAt(HeapPage* page, int index) {
+  return (Object*)((char*)page + HEAP_PAGE_HEADER + (size_t)index * page->cellSize);
+}
+
+// Finalizes every unmarked object on the page and threads its free cells
+// onto the size class free list. Returns the number of surviving objects.
+static int sweepPage(Heap* heap, SizeClass* sizeClass, HeapPage* page) {
+  int live = 0;
+  HeapCell* freeList = sizeClass->freeList;
+
+  for (int i = page->cellCount - 1; i >= 0; i--) {
+    Object* object = cellAt(page, i);
+    size_t granule = GRANULE_OF(object);
+
+    if (testBit(page->allocBits, granule)) {
+      if (testBit(page->markBits, granule)) {
+        live++;
+        continue;
+      }
+
+      freeObject(object);
+      clearBit(page->allocBits, granule);
+      heap->cellBytes -= page->cellSize;
+      vm.bytesAllocated -= page->cellSize;
+      vm.gcStats.totalFreed += page->cellSize;
+    }
+
+    HeapCell* cell = (HeapCell*)object;
+    cell->next = freeList;
+    freeList = cell;
+  }
+
+  if (live > 0) sizeClass->freeList = freeList;
+  return live;
+}
+
+static bool sweepNextPage(Heap* heap, SizeClass* sizeClass) {
+  HeapPage* page = sizeClass->sweepCursor;
+  if (page == NULL) return false;
+
+  sizeClass->sweepCursor = page->next;
+
+  if (sweepPage(heap, sizeClass, page) == 0) {
+    unlinkPage(&sizeClass->pages, page);
+    heap->pageCount--;
+    releasePage(page);
+  }
+
+  return true;
+}
+
+static void* allocateLarge(Heap* heap, size_t size) {
+  size_t mappedSize = (HEAP_PAGE_HEADER + size + HEAP_PAGE_SIZE - 1) & ~(size_t)(HEAP_PAGE_SIZE - 1);
+  HeapPage* page = newPage(mappedSize, -1, size);
+  if (page == NULL) return NULL;
+
+  linkPage(&heap->largePages, page);
+
+  Object* object = cellAt(page, 0);
+  setBit(page->allocBits, GRANULE_OF(object));
+  heap->cellBytes += size;
+  vm.bytesAllocated += size;
+  vm.gcStats.totalAllocated += size;
+  return object;
+}
+
+void* heapAllocate(Heap* heap, size_t size) {
+  if (size > HEAP_MAX_CELL) return allocateLarge(heap, size);
+  if (size < HEAP_MIN_CELL) size = HEAP_MIN_CELL;
+
+  SizeClass* sizeClass = &heap->classes[sizeClassIndex[(size + HEAP_GRANULE - 1) / HEAP_GRANULE]];
+
+  while (sizeClass->freeList == NULL) {
+    if (sweepNextPage(heap, sizeClass)) continue;
+
+    int index = (int)(sizeClass - heap->classes);
+    HeapPage* page = newPage(HEAP_PAGE_SIZE, index, sizeClass->cellSize);
+    if (page == NULL) return NULL;
+
+    linkPage(&sizeClass->pages, page);
+    heap->pageCount++;
+
+    for (int i = page->cellCount - 1; i >= 0; i--) {
+      HeapCell* cell = (HeapCell*)cellAt(page, i);
+      cell->next = sizeClass->freeList;
+      sizeClass->freeList = cell;
+    }
+  }
+
+  HeapCell* cell = sizeClass->freeList;
+  sizeClass->freeList = cell->next;
+
+  setBit(PAGE_OF(cell)->allocBits, GRANULE_OF(cell));
+  heap->cellBytes += sizeClass->cellSize;
+  vm.bytesAllocated += sizeClass->cellSize;
+  vm.gcStats.totalAllocated += sizeClass->cellSize;
+  return cell;
+}
+
+static inline size_t bufferMapping(size_t size) {
+  return (size + osPageSize - 1) & ~(osPageSize - 1);
+}
+
+// Every mapped buffer is recorded here with the length of its mapping, so
+// whether a buffer is unmapped or freed, and how much is unmapped, never
+// depends on the size a caller passes back. Open addressing with linear
+// probing; removal shifts later entries back instead of leaving tombstones.
+typedef struct {
+  void* buffer;
+  size_t mapping;
+} MappedBuffer;
+
+static MappedBuffer* mappedBuffers = NULL;
+static size_t mappedCapacity = 0;
+static size_t mappedCount = 0;
+
+static inline size_t mappedSlot(void* buffer, size_t capacity) {
+  return (size_t)(((uintptr_t)buffer >> 12) * 0x9E3779B97F4A7C15ull) & (capacity - 1);
+}
+
+// Returns the slot that holds buffer, or the empty slot where it would go.
+static size_t findMapped(MappedBuffer* entries, size_t capacity, void* buffer) {
+  size_t slot = mappedSlot(buffer, capacity);
+  while (entries[slot].buffer != NULL && entries[slot].buffer != buffer) slot = (slot + 1) & (capacity - 1);
+  return slot;
+}
+
+// Returns the length of buffer's mapping, or 0 if it came from malloc.
+static size_t mappingOf(void* buffer) {
+  if (mappedCount == 0 || buffer == NULL) return 0;
+  return mappedBuffers[findMapped(mappedBuffers, mappedCapacity, buffer)].mapping;
+}
+
+static bool recordMapped(void* buffer, size_t mapping) {
+  if ((mappedCount + 1) * 2 > mappedCapacity) {
+    size_t capacity = mappedCapacity < 64 ? 64 : mappedCapacity * 2;
+    MappedBuffer* entries = (MappedBuffer*)calloc(capacity, sizeof(MappedBuffer));
+    if (entries == NULL) return false;
+
+    for (size_t i = 0; i < mappedCapacity; i++) {
+      if (mappedBuffers[i].buffer == NULL) continue;
+      entries[findMapped(entries, capacity, mappedBuffers[i].buffer)] = mappedBuffers[i];
+    }
+
+    free(mappedBuffers);
+    mappedBuffers = entries;
+    mappedCapacity = capacity;
+  }
+
+  MappedBuffer* entry = &mappedBuffers[findMapped(mappedBuffers, mappedCapacity, buffer)];
+  entry->buffer = buffer;
+  entry->mapping = mapping;
+  mappedCount++;
+  return true;
+}
+
+static void forgetMapped(void* buffer) {
+  size_t mask = mappedCapacity - 1;
+  size_t hole = findMapped(mappedBuffers, mappedCapacity, buffer);
+  mappedBuffers[hole] = (MappedBuffer){NULL, 0};
+  mappedCount--;
+
+  for (size_t slot = (hole + 1) & mask; mappedBuffers[slot].buffer != NULL; slot = (slot + 1) & mask) {
+    size_t home = mappedSlot(mappedBuffers[slot].buffer, mappedCapacity);
+    bool movable = hole <= slot ? home <= hole || home > slot : home <= hole && home > slot;
+    if (!movable) continue;
+
+    mappedBuffers[hole] = mappedBuffers[slot];
+    mappedBuffers[slot] = (MappedBuffer){NULL, 0};
+    hole = slot;
+  }
+}
+
+static void* mapBuffer(size_t size) {
+  size_t mapping = bufferMapping(size);
+  void* buffer = mmap(NULL, mapping, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (buffer == MAP_FAILED) return NULL;
+
+  if (!recordMapped(buffer, mapping)) {
+    munmap(buffer, mapping);
+    return NULL;
+  }
+
+  return buffer;
+}
+
+static void unmapBuffer(void* buffer, size_t mapping) {
+  forgetMapped(buffer);
+  munmap(buffer, mapping);
+}
+
+// Backs the non-object buffers (chunks, value arrays, tables). Buffers of
+// at least HEAP_LARGE_BUFFER bytes bypass malloc: they are mapped directly,
+// grown or shrunk by mremap() without copying, and unmapped as soon as they
+// are freed. Returns NULL if the memory is not available, leaving the
+// original buffer intact.
+void* heapReallocate(void* pointer, size_t oldSize, size_t newSize) {
+  size_t oldMapping = mappingOf(pointer);
+  bool wasMapped = oldMapping > 0;
+  bool isMapped = newSize >= HEAP_LARGE_BUFFER;
+
+  if (!wasMapped && !isMapped) {
+    if (newSize == 0) {
+      free(pointer);
+      return NULL;
+    }
+
+    return realloc(pointer, newSize);
+  }
+
+  if (wasMapped && isMapped) {
+    size_t newMapping = bufferMapping(newSize);
+    if (oldMapping == newMapping) return pointer;
+
+    void* result = mremap(pointer, oldMapping, newMapping, MREMAP_MAYMOVE);
+    if (result == MAP_FAILED) return NULL;
+
+    // Same count, so recording the new address cannot fail.
+    forgetMapped(pointer);
+    recordMapped(result, newMapping);
+    return result;
+  }
+
+  void* result = NULL;
+  if (newSize > 0) {
+    result = isMapped ? mapBuffer(newSize) : malloc(newSize);
+    if (result == NULL) return NULL;
+
+    size_t copy = oldSize < newSize ? oldSize : newSize;
+    if (wasMapped && copy > oldMapping) copy = oldMapping;
+    if (pointer != NULL && copy > 0) memcpy(result, pointer, copy);
+  }
+
+  if (wasMapped) {
+    unmapBuffer(pointer, oldMapping);
+  } else {
+    free(pointer);
+  }
+
+  return result;
+}
+
+void heapClearMarks(Heap* heap) {
+  for (int i = 0; i < HEAP_SIZE_CLASSES; i++) {
+    for (HeapPage* page = heap->classes[i].pages; page != NULL; page = page->next) {
+      memset(page->markBits, 0, sizeof(page->markBits));
+    }
+  }
+
+  for (HeapPage* page = heap->largePages; page != NULL; page = page->next) {
+    memset(page->markBits, 0, sizeof(page->markBits));
+  }
+
+  heap->markedBytes = 0;
+}
+
+// Starts a lazy sweep. Small pages are swept on demand by heapAllocate();
+// large objects are released immediately since each one owns its page.
+void heapBeginSweep(Heap* heap) {
+  for (int i = 0; i < HEAP_SIZE_CLASSES; i++) {
+    heap->classes[i].freeList = NULL;
+    heap->classes[i].sweepCursor = heap->classes[i].pages;
+  }
+
+  HeapPage* page = heap->largePages;
+  while (page != NULL) {
+    HeapPage* next = page->next;
+    Object* object = cellAt(page, 0);
+
+    if (!isObjectMarked(object)) {
+      freeObject(object);
+      heap->cellBytes -= page->cellSize;
+      vm.bytesAllocated -= page->cellSize;
+      vm.gcStats.totalFreed += page->cellSize;
+      unlinkPage(&heap->largePages, page);
+      releasePage(page);
+    }
+
+    page = next;
+  }
+}
+
+void heapFinishSweep(Heap* heap) {
+  for (int i = 0; i < HEAP_SIZE_CLASSES; i++) {
+    while (sweepNextPage(heap, &heap->classes[i]));
+  }
+}
+
+double heapFragmentation(Heap* heap) {
+  size_t capacity = 0;
+  size_t live = heap->markedBytes;
+
+  for (int i = 0; i < HEAP_SIZE_CLASSES; i++) {
+    for (HeapPage* page = heap->classes[i].pages; page != NULL; page = page->next) {
+      capacity += (size_t)page->cellCount * page->cellSize;
+    }
+  }
+
+  for (HeapPage* page = heap->largePages; page != NULL; page = page->next) {
+    if (isObjectMarked(cellAt(page, 0))) live -= page->cellSize;
+  }
+
+  if (capacity == 0) return 0;
+  return 1.0 - (double)live / (double)capacity;
+}
+
+static int countLive(HeapPage* page) {
+  int live = 0;
+  for (int i = 0; i < HEAP_BITMAP_WORDS; i++) {
+    live += __builtin_popcountll(page->allocBits[i]);
+  }
+
+  return live;
+}
+
+static int compareLiveCount(const void* a, const void* b) {
+  return (*(HeapPage**)a)->liveCount - (*(HeapPage**)b)->liveCount;
+}
+
+static inline bool isAllocated(HeapPage* page, int index) {
+  return testBit(page->allocBits, GRANULE_OF(cellAt(page, index)));
+}
+
+// Slides live objects out of the sparsest pages of a size class into the
+// free cells of the densest ones, leaving a forwarding address behind.
+static bool evacuateClass(SizeClass* sizeClass) {
+  int pageCount = 0;
+  int totalLive = 0;
+  int cellsPerPage = 0;
+
+  for (HeapPage* page = sizeClass->pages; page != NULL; page = page->next) {
+    page->liveCount = countLive(page);
+    totalLive += page->liveCount;
+    cellsPerPage = page->cellCount;
+    pageCount++;
+  }
+
+  if (pageCount < 2) return false;
+  if ((totalLive + cellsPerPage - 1) / cellsPerPage >= pageCount) return false;
+
+  HeapPage** pages = (HeapPage**)malloc(sizeof(HeapPage*) * pageCount);
+  if (pages == NULL) return false;
+
+  int index = 0;
+  for (HeapPage* page = sizeClass->pages; page != NULL; page = page->next) {
+    pages[index++] = page;
+  }
+
+  qsort(pages, pageCount, sizeof(HeapPage*), compareLiveCount);
+
+  int source = 0;
+  int target = pageCount - 1;
+  int sourceCell = 0;
+  int targetCell = 0;
+  bool moved = false;
+
+  while (source < target) {
+    HeapPage* from = pages[source];
+    HeapPage* to = pages[target];
+
+    while (sourceCell < from->cellCount && !isAllocated(from, sourceCell)) sourceCell++;
+    if (sourceCell == from->cellCount) {
+      source++;
+      sourceCell = 0;
+      continue;
+    }
+
+    while (targetCell < to->cellCount && isAllocated(to, targetCell)) targetCell++;
+    if (targetCell == to->cellCount) {
+      target--;
+      targetCell = 0;
+      continue;
+    }
+
+    Object* object = cellAt(from, sourceCell);
+    Object* copy = cellAt(to, targetCell);
+    memcpy(copy, object, from->cellSize);
+    relocateObject(copy, object);
+
+    setBit(to->allocBits, GRANULE_OF(copy));
+    setBit(to->markBits, GRANULE_OF(copy));
+    clearBit(from->allocBits, GRANULE_OF(object));
+    object->gcBits |= GC_FORWARDED;
+    ((Object**)object)[1] = copy;
+
+    from->evacuating = true;
+    moved = true;
+  }
+
+  free(pages);
+  return moved;
+}
+
+// Requires a fully swept heap in which every allocated object is marked.
+bool heapEvacuate(Heap* heap) {
+  bool moved = false;
+  for (int i = 0; i < HEAP_SIZE_CLASSES; i++) {
+    if (evacuateClass(&heap->classes[i])) moved = true;
+  }
+
+  return moved;
+}
+
+// Unmaps the pages emptied by heapEvacuate() and lets the lazy sweeper
+// rebuild the free lists from the surviving pages.
+void heapReleaseEvacuated(Heap* heap) {
+  for (int i = 0; i < HEAP_SIZE_CLASSES; i++) {
+    SizeClass* sizeClass = &heap->classes[i];
+    HeapPage* page = sizeClass->pages;
+
+    while (page != NULL) {
+      HeapPage* next = page->next;
+
+      if (page->evacuating) {
+        page->evacuating = false;
+
+        if (countLive(page) == 0) {
+          unlinkPage(&sizeClass->pages, page);
+          heap->pageCount--;
+          releasePage(page);
+        }
+      }
+
+      page = next;
+    }
+
+    sizeClass->freeList = NULL;
+    sizeClass->sweepCursor = sizeClass->pages;
+  }
+}
+
+static void forEachInPages(HeapPage* page, void (*function)(Object* object)) {
+  for (; page != NULL; page = page->next) {
+    for (int i = 0; i < page->cellCount; i++) {
+      if (isAllocated(page, i)) function(cellAt(page, i));
+    }
+  }
+}
+
+void heapForEachObject(Heap* heap, void (*function)(Object* object)) {
+  for (int i = 0; i < HEAP_SIZE_CLASSES; i++) {
+    forEachInPages(heap->classes[i].pages, function);
+  }
+
+  forEachInPages(heap->largePages, function);
+}
+
+static void freePages(HeapPage* page) {
+  while (page != NULL) {
+    HeapPage* next = page->next;
+
+    for (int i = 0; i < page->cellCount; i++) {
+      Object* object = cellAt(page, i);
+      if (testBit(page->allocBits, GRANULE_OF(object))) freeObject(object);
+    }
+
+    releasePage(page);
+    page = next;
+  }
+}
+
+void freeHeap(Heap* heap) {
+  for (int i = 0; i < HEAP_SIZE_CLASSES; i++) {
+    freePages(heap->classes[i].pages);
+  }
+
+  freePages(heap->largePages);
+  initHeap(heap);
+}
@@ -1,50 +1,248 @@
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <unistd.h>
 
 #include "../include/compiler.h"
+#include "../include/heap.h"
 #include "../include/memory.h"
 #include "../include/vm.h"
 
 #ifdef DEBUG_LOG_GARBAGE_COLLECT
-#include <stdio.h>
 #include "../include/debug.h"
 #endif
 
-#define GC_HEAP_GROW_FACTOR 2
+#define GC_COMPACT_MIN_PAGES 16
 
-void* reallocate(void* pointer, size_t oldSize, size_t newSize) {
-  vm.bytesAllocated += newSize - oldSize;
+static const char* objectTypeNames[OBJECT_TYPE_COUNT] = {
+  "class", "closure", "file", "float64array", "function", "instance",
+  "list", "map", "native", "rope", "source", "string", "stringbuilder", "upvalue"
+};
 
-  if (newSize > oldSize) {
-    #ifdef DEBUG_STRESS_GARBAGE_COLLECT
-      collectGarbage();
-    #endif
+static const char* pauseBucketNames[GC_PAUSE_BUCKETS] = {
+  "under1us", "under10us", "under100us", "under1ms",
+  "under10ms", "under100ms", "under1s", "over1s"
+};
+
+const char* objectTypeName(ObjectType type) {
+  return objectTypeNames[type];
+}
+
+const char* pauseBucketName(int bucket) {
+  return pauseBucketNames[bucket];
+}
+
+// Accepts a plain byte count or one with a K, M or G suffix.
+bool parseSize(const char* text, size_t* size) {
+  char* end;
+  double value = strtod(text, &end);
+  if (end == text || value < 0) return false;
+
+  switch (*end) {
+    case 'k': case 'K': value *= 1024; end++; break;
+    case 'm': case 'M': value *= 1024 * 1024; end++; break;
+    case 'g': case 'G': value *= 1024 * 1024 * 1024; end++; break;
+  }
+
+  if (*end != '\0') return false;
+  *size = (size_t)value;
+  return true;
+}
+
+static bool parseRatio(const char* text, double* ratio) {
+  char* end;
+  *ratio = strtod(text, &end);
+  return end != text && *end == '\0' && *ratio >= 0;
+}
+
+// Applies a single named setting. Only "stats" may omit its value.
+bool setGCOption(GCConfig* config, const char* name, const char* value) {
+  if (strcmp(name, "stats") == 0) {
+    config->reportStats = value == NULL || strcmp(value, "0") != 0;
+    return true;
+  }
+
+  if (value == NULL) return false;
+
+  if (strcmp(name, "initial") == 0) return parseSize(value, &config->initialThreshold);
+  if (strcmp(name, "min") == 0) return parseSize(value, &config->minThreshold);
+  if (strcmp(name, "max") == 0) return parseSize(value, &config->maxThreshold);
+  if (strcmp(name, "limit") == 0) return parseSize(value, &config->heapLimit);
+  if (strcmp(name, "growth") == 0) return parseRatio(value, &config->growFactor) && config->growFactor >= 1;
+  if (strcmp(name, "compact") == 0) return parseRatio(value, &config->compactFragmentation);
+
+  return false;
+}
+
+// Defaults, overridden by any MAKRO_GC_* environment variables.
+void initGCConfig(GCConfig* config) {
+  config->initialThreshold = 1024 * 1024;
+  config->minThreshold = 1024 * 1024;
+  config->maxThreshold = 0;
+  config->heapLimit = 0;
+  config->growFactor = 2;
+  config->compactFragmentation = 0.5;
+  config->reportStats = false;
+
+  static const char* options[][2] = {
+    {"MAKRO_GC_INITIAL", "initial"},
+    {"MAKRO_GC_MIN", "min"},
+    {"MAKRO_GC_MAX", "max"},
+    {"MAKRO_GC_LIMIT", "limit"},
+    {"MAKRO_GC_GROWTH", "growth"},
+    {"MAKRO_GC_COMPACT", "compact"},
+    {"MAKRO_GC_STATS", "stats"}
+  };
+
+  for (size_t i = 0; i < sizeof(options) / sizeof(options[0]); i++) {
+    const char* value = getenv(options[i][0]);
+    if (value != NULL && !setGCOption(config, options[i][1], value)) {
+      fprintf(stderr, "Ignoring invalid %s value \"%s\".\n", options[i][0], value);
+    }
+  }
+}
+
+// For embedders: replaces the VM's collector settings. Before the first
+// collection this also resets the initial threshold.
+void configureGC(const GCConfig* config) {
+  vm.gcConfig = *config;
+  if (vm.gcStats.collections == 0) vm.nextGC = config->initialThreshold;
+}
+
+// The next collection comes once the heap has grown past the live bytes by
+// (growth - 1) times them, with that headroom kept between the min and max
+// settings. Bounding the headroom rather than the threshold means a heap
+// whose live data outgrows max still has room to allocate between
+// collections; the heap itself is only capped by the limit setting.
+static void updateThreshold(size_t liveBytes) {
+  size_t headroom = (size_t)(liveBytes * (vm.gcConfig.growFactor - 1));
+  if (headroom < vm.gcConfig.minThreshold) headroom = vm.gcConfig.minThreshold;
+  if (vm.gcConfig.maxThreshold > 0 && headroom > vm.gcConfig.maxThreshold) headroom = vm.gcConfig.maxThreshold;
+  vm.nextGC = liveBytes + headroom;
+}
+
+static uint64_t monotonicNanos() {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t)now.tv_sec * 1000000000u + (uint64_t)now.tv_nsec;
+}
+
+static void recordPause(uint64_t start) {
+  uint64_t pause = monotonicNanos() - start;
+  vm.gcStats.totalPauseNanos += pause;
+  if (pause > vm.gcStats.maxPauseNanos) vm.gcStats.maxPauseNanos = pause;
+
+  int bucket = 0;
+  for (uint64_t limit = 1000; pause >= limit && bucket < GC_PAUSE_BUCKETS - 1; limit *= 10) {
+    bucket++;
+  }
+
+  vm.gcStats.pauseHistogram[bucket]++;
+}
+
+void reportGCStats() {
+  GCStats* stats = &vm.gcStats;
+
+  fprintf(stderr, "-- GC Stats\n");
+  fprintf(stderr, "   collections      %d\n", stats->collections);
+  fprintf(stderr, "   compactions      %d\n", stats->compactions);
+  fprintf(stderr, "   total pause      %.3f ms\n", stats->totalPauseNanos / 1e6);
+  fprintf(stderr, "   max pause        %.3f ms\n", stats->maxPauseNanos / 1e6);
+  fprintf(stderr, "   bytes allocated  %zu\n", stats->totalAllocated);
+  fprintf(stderr, "   bytes freed      %zu\n", stats->totalFreed);
+  fprintf(stderr, "   heap bytes       %zu (next GC at %zu)\n", vm.bytesAllocated, vm.nextGC);
+
+  fprintf(stderr, "   live bytes at last collection:\n");
+  for (int i = 0; i < OBJECT_TYPE_COUNT; i++) {
+    if (stats->liveBytes[i] > 0) fprintf(stderr, "     %-14s %zu\n", objectTypeNames[i], stats->liveBytes[i]);
+  }
+
+  fprintf(stderr, "   pause histogram:\n");
+  for (int i = 0; i < GC_PAUSE_BUCKETS; i++) {
+    fprintf(stderr, "     %-14s %d\n", pauseBucketNames[i], stats->pauseHistogram[i]);
+  }
+}
+
+// A full collection with the lazy sweep completed, so everything
+// unreachable is actually released before we give up on an allocation.
+static void collectEmergency() {
+  collectGarbage();
+  heapFinishSweep(&vm.heap);
+}
 
-    if (vm.bytesAllocated > vm.nextGC) {
+static _Noreturn void outOfMemory(size_t size) {
+  throwRuntimeError("Out of memory: could not allocate %zu bytes", size);
+}
+
+static void reserveHeap(size_t size) {
+  #ifdef DEBUG_STRESS_GARBAGE_COLLECT
+    if (vm.debug.stressGC) {
       collectGarbage();
     }
+  #endif
+
+  if (vm.bytesAllocated + size > vm.nextGC) {
+    collectGarbage();
   }
 
-  if (newSize == 0) {
-    free(pointer);
-    return NULL;
+  size_t limit = vm.gcConfig.heapLimit;
+  if (limit == 0 || vm.bytesAllocated + size <= limit) return;
+
+  collectEmergency();
+  if (vm.bytesAllocated + size > limit) {
+    throwRuntimeError("Out of memory: allocating %zu bytes would exceed the heap limit of %zu bytes", size, limit);
   }
+}
 
-  void* result = realloc(pointer, newSize);
-  if (result == NULL) exit(1);
+void* reallocate(void* pointer, size_t oldSize, size_t newSize) {
+  if (newSize > oldSize) reserveHeap(newSize - oldSize);
+
+  void* result = heapReallocate(pointer, oldSize, newSize);
+  if (result == NULL && newSize > 0) {
+    collectEmergency();
+    result = heapReallocate(pointer, oldSize, newSize);
+    if (result == NULL) outOfMemory(newSize);
+  }
+
+  vm.bytesAllocated += newSize - oldSize;
+  if (newSize > oldSize) {
+    vm.gcStats.totalAllocated += newSize - oldSize;
+  } else {
+    vm.gcStats.totalFreed += oldSize - newSize;
+  }
 
   return result;
 }
 
+void* allocateCell(size_t size) {
+  reserveHeap(size);
+
+  void* cell = heapAllocate(&vm.heap, size);
+  if (cell == NULL) {
+    collectEmergency();
+    cell = heapAllocate(&vm.heap, size);
+    if (cell == NULL) outOfMemory(size);
+  }
+
+  return cell;
+}
+
 void markObject(Object *object) {
   if (object == NULL) return;
-  if (object->isMarked) return;
+  if (isObjectMarked(object)) return;
 
   #ifdef DEBUG_LOG_GARBAGE_COLLECT
-    printf("%p mark ", (void*)object);
-    printValue(OBJECT_VAL(object));
-    printf("\n");
+    if (vm.debug.logGC) {
+      printf("%p mark ", (void*)object);
+      printValue(OBJECT_VAL(object));
+      printf("\n");
+    }
   #endif
-  object->isMarked = true;
+  setObjectMarked(object);
+  vm.heap.markedBytes += PAGE_OF(object)->cellSize;
+  vm.gcStats.liveBytes[object->type] += PAGE_OF(object)->cellSize;
 
   if (vm.grayCapacity < vm.grayCount + 1) {
     vm.grayCapacity = GROW_CAPACITY(vm.grayCapacity);
@@ -66,11 +264,23 @@ void markArray(ValueArray* array) {
   }
 }
 
+void forwardValue(Value* value) {
+  if (IS_OBJECT(*value)) value->as.object = forwardObject(AS_OBJECT(*value));
+}
+
+static void forwardArray(ValueArray* array) {
+  for (int i = 0; i < array->count; i++) {
+    forwardValue(&array->values[i]);
+  }
+}
+
 static void blackenObject(Object* object) {
   #ifdef DEBUG_LOG_GARBAGE_COLLECT
-    printf("%p blacken ", (void*)object);
-    printValue(OBJECT_VAL(object));
-    printf("\n");
+    if (vm.debug.logGC) {
+      printf("%p blacken ", (void*)object);
+      printValue(OBJECT_VAL(object));
+      printf("\n");
+    }
   #endif
 
 
@@ -97,53 +307,189 @@ static void blackenObject(Object* object) {
       markObject((Object*)instance->_class);
       markTable(&instance->fields);
       break;
+    case OBJECT_LIST:
+      markArray(&((ObjectList*)object)->items);
+      break;
+    case OBJECT_MAP:
+      markMap(&((ObjectMap*)object)->map);
+      break;
+    case OBJECT_ROPE:
+      ObjectRope* rope = (ObjectRope*)object;
+      markObject(rope->left);
+      markObject(rope->right);
+      markObject((Object*)rope->flat);
+      break;
+    case OBJECT_STRING:
+      if (object->gcBits & STRING_BORROWED) markObject(STRING_OWNER((ObjectString*)object));
+      break;
     case OBJECT_UPVALUE:
       markValue(((ObjectUpvalue*)object)->closed);
       break;
+    case OBJECT_FILE:
+    case OBJECT_FLOAT64_ARRAY:
     case OBJECT_NATIVE:
-    case OBJECT_STRING:
+    case OBJECT_SOURCE:
+    case OBJECT_STRING_BUILDER:
       break;
   }
 }
 
-static void freeObject(Object* object) {
+void freeObject(Object* object) {
   #ifdef DEBUG_LOG_GARBAGE_COLLECT
-    printf("%p free type %d\n", (void*)object, object->type);
+    if (vm.debug.logGC) {
+      printf("%p free type %d\n", (void*)object, object->type);
+    }
   #endif
   
+  switch (object->type) {
+    case OBJECT_FUNCTION:
+      ObjectFunction* function = (ObjectFunction*)object;
+      freeChunk(&function->chunk);
+      break;
+    case OBJECT_INSTANCE:
+      ObjectInstance* instance = (ObjectInstance*)object;
+      freeTable(&instance->fields);
+      break;
+    case OBJECT_FILE:
+      ObjectFile* file = (ObjectFile*)object;
+      freeOutput(&file->output);
+      free(file->input);
+      if (file->fd >= 0) close(file->fd);
+      break;
+    case OBJECT_FLOAT64_ARRAY:
+      ObjectFloat64Array* array = (ObjectFloat64Array*)object;
+      FREE_ARRAY(double, array->values, array->length);
+      break;
+    case OBJECT_LIST:
+      freeValueArray(&((ObjectList*)object)->items);
+      break;
+    case OBJECT_MAP:
+      freeMap(&((ObjectMap*)object)->map);
+      break;
+    case OBJECT_STRING_BUILDER:
+      ObjectStringBuilder* builder = (ObjectStringBuilder*)object;
+      FREE_ARRAY(char, builder->chars, builder->capacity);
+      break;
+    case OBJECT_SOURCE:
+      ObjectSource* source = (ObjectSource*)object;
+      if (source->mapped) {
+        munmap(source->chars, source->length);
+      } else {
+        free(source->chars);
+      }
+      break;
+    case OBJECT_CLASS:
+    case OBJECT_CLOSURE:
+    case OBJECT_NATIVE:
+    case OBJECT_ROPE:
+    case OBJECT_STRING:
+    case OBJECT_UPVALUE:
+      break;
+  }
+}
+
+// Fixes up pointers into the object itself after the heap has copied it
+// from one cell to another during compaction.
+void relocateObject(Object* object, Object* from) {
+  switch (object->type) {
+    case OBJECT_UPVALUE:
+      ObjectUpvalue* upvalue = (ObjectUpvalue*)object;
+      if (upvalue->location == &((ObjectUpvalue*)from)->closed) {
+        upvalue->location = &upvalue->closed;
+      }
+      break;
+    case OBJECT_STRING:
+      ObjectString* string = (ObjectString*)object;
+      if (!(object->gcBits & STRING_BORROWED)) string->chars = string->storage;
+      break;
+    default:
+      break;
+  }
+}
+
+static void forwardReferences(Object* object) {
   switch (object->type) {
     case OBJECT_CLASS:
-      FREE(ObjectClass, object);
+      ObjectClass* _class = (ObjectClass*)object;
+      _class->name = (ObjectString*)forwardObject((Object*)_class->name);
       break;
     case OBJECT_CLOSURE:
       ObjectClosure* closure = (ObjectClosure*)object;
-      FREE_ARRAY(ObjectUpvalue*, closure->upvalues, closure->upvalueCount);
-      FREE(OBJECT_CLOSURE, object);
+      closure->function = (ObjectFunction*)forwardObject((Object*)closure->function);
+
+      for (int i = 0; i < closure->upvalueCount; i++) {
+        closure->upvalues[i] = (ObjectUpvalue*)forwardObject((Object*)closure->upvalues[i]);
+      }
       break;
     case OBJECT_FUNCTION:
       ObjectFunction* function = (ObjectFunction*)object;
-      freeChunk(&function->chunk);
-      FREE(ObjectFunction, object);
+      function->name = (ObjectString*)forwardObject((Object*)function->name);
+      forwardArray(&function->chunk.constants);
       break;
     case OBJECT_INSTANCE:
       ObjectInstance* instance = (ObjectInstance*)object;
-      freeTable(&instance->fields);
-      FREE(ObjectInstance, object);
+      instance->_class = (ObjectClass*)forwardObject((Object*)instance->_class);
+      forwardTable(&instance->fields);
       break;
-    case OBJECT_NATIVE:
-      FREE(ObjectNative, object);
+    case OBJECT_LIST:
+      forwardArray(&((ObjectList*)object)->items);
+      break;
+    case OBJECT_MAP:
+      forwardMap(&((ObjectMap*)object)->map);
+      break;
+    case OBJECT_ROPE:
+      ObjectRope* rope = (ObjectRope*)object;
+      rope->left = forwardObject(rope->left);
+      rope->right = forwardObject(rope->right);
+      rope->flat = (ObjectString*)forwardObject((Object*)rope->flat);
+      break;
+    case OBJECT_UPVALUE:
+      ObjectUpvalue* upvalue = (ObjectUpvalue*)object;
+      forwardValue(&upvalue->closed);
+      upvalue->next = (ObjectUpvalue*)forwardObject((Object*)upvalue->next);
       break;
     case OBJECT_STRING:
       ObjectString* string = (ObjectString*)object;
-      FREE_ARRAY(char, string->chars, string->length + 1);
-      FREE(ObjectString, object);
+      if (!(object->gcBits & STRING_BORROWED)) break;
+
+      // A view into another string's inline storage has to follow it. The
+      // evacuated cell still holds its old chars pointer, past the
+      // forwarding pointer, which gives the view's offset.
+      _Static_assert(offsetof(ObjectString, chars) >= 2 * sizeof(Object*), "chars overlaps the forwarding pointer");
+      Object* owner = STRING_OWNER(string);
+      Object* moved = forwardObject(owner);
+      if (moved != owner && moved->type == OBJECT_STRING) {
+        ptrdiff_t offset = string->chars - ((ObjectString*)owner)->chars;
+        string->chars = ((ObjectString*)moved)->chars + offset;
+      }
+
+      STRING_OWNER(string) = moved;
       break;
-    case OBJECT_UPVALUE:
-      FREE(ObjectUpvalue, object);
+    case OBJECT_FILE:
+    case OBJECT_FLOAT64_ARRAY:
+    case OBJECT_NATIVE:
+    case OBJECT_SOURCE:
+    case OBJECT_STRING_BUILDER:
       break;
   }
 }
 
+static void forwardRoots() {
+  for (Value* slot = vm.stack; slot < vm.stackTop; slot++) {
+    forwardValue(slot);
+  }
+
+  for (int i = 0; i < vm.frameCount; i++) {
+    vm.frames[i].closure = (ObjectClosure*)forwardObject((Object*)vm.frames[i].closure);
+  }
+
+  vm.openUpvalues = (ObjectUpvalue*)forwardObject((Object*)vm.openUpvalues);
+
+  vm.jsonClass = (ObjectClass*)forwardObject((Object*)vm.jsonClass);
+  forwardTable(&vm.globals);
+  forwardInternSet(&vm.strings);
+}
+
 static void markRoots() {
   for (Value* slot = vm.stack; slot < vm.stackTop; slot++) {
     markValue(*slot);
@@ -157,6 +503,7 @@ static void markRoots() {
     markObject((Object*)upvalue);
   }
 
+  markObject((Object*)vm.jsonClass);
   markTable(&vm.globals);
   markCompilerRoots();
 }
@@ -168,56 +515,82 @@ static void traceReferences() {
   }
 }
 
-static void sweep() {
-  Object* previous = NULL;
-  Object* object = vm.objects;
-
-  while (object != NULL) {
-    if (object->isMarked) {
-      object->isMarked = false;
-      previous = object;
-      object = object->next;
-    } else {
-      Object* unreached = object;
-      object = object->next;
+static void markHeap() {
+  heapFinishSweep(&vm.heap);
+  heapClearMarks(&vm.heap);
+  memset(vm.gcStats.liveBytes, 0, sizeof(vm.gcStats.liveBytes));
 
-      if (previous != NULL) {
-        previous->next = object;
-      } else {
-        vm.objects = object;
-      }
+  markRoots();
+  traceReferences();
+  internSetSweep(&vm.strings);
+}
 
-      freeObject(unreached);
+void collectGarbage() {
+  #ifdef DEBUG_LOG_GARBAGE_COLLECT
+    if (vm.debug.logGC) {
+      printf("-- GC Begin\n");
     }
+  #endif
+
+  uint64_t start = monotonicNanos();
+  markHeap();
+
+  if (vm.gcConfig.compactFragmentation > 0 && vm.heap.pageCount >= GC_COMPACT_MIN_PAGES &&
+      heapFragmentation(&vm.heap) > vm.gcConfig.compactFragmentation) {
+    vm.shouldCompact = true;
   }
+
+  heapBeginSweep(&vm.heap);
+  updateThreshold(vm.bytesAllocated - (vm.heap.cellBytes - vm.heap.markedBytes));
+
+  vm.gcStats.collections++;
+  recordPause(start);
+
+  #ifdef DEBUG_LOG_GARBAGE_COLLECT
+    if (vm.debug.logGC) {
+      printf("-- GC End\n");
+      printf("   marked %zu of %zu object bytes, next at %zu\n", vm.heap.markedBytes, vm.heap.cellBytes, vm.nextGC);
+    }
+  #endif
 }
 
-void collectGarbage() {
+// Moving objects invalidates any pointer held in a C local, so compaction is
+// only requested by collectGarbage() and performed by the interpreter at a
+// safe point between instructions.
+void compactHeap() {
   #ifdef DEBUG_LOG_GARBAGE_COLLECT
-    printf("-- GC Begin\n");
-    size_t before = vm.bytesAllocated;
+    if (vm.debug.logGC) {
+      printf("-- Compact Begin\n");
+    }
   #endif
 
-  markRoots();
-  traceReferences();
-  tableRemoveWhite(&vm.strings);
-  sweep();
+  vm.shouldCompact = false;
+
+  uint64_t start = monotonicNanos();
+  markHeap();
+  heapBeginSweep(&vm.heap);
+  heapFinishSweep(&vm.heap);
+
+  if (heapEvacuate(&vm.heap)) {
+    forwardRoots();
+    heapForEachObject(&vm.heap, forwardReferences);
+  }
+
+  heapReleaseEvacuated(&vm.heap);
+  updateThreshold(vm.bytesAllocated);
 
-  vm.nextGC = vm.bytesAllocated * GC_HEAP_GROW_FACTOR;
+  vm.gcStats.compactions++;
+  recordPause(start);
 
   #ifdef DEBUG_LOG_GARBAGE_COLLECT
-    printf("-- GC End\n");
-    printf("   collected %zu bytes (from %zu to %zu) next at %zu\n", before - vm.bytesAllocated, before, vm.bytesAllocated, vm.nextGC);
+    if (vm.debug.logGC) {
+      printf("-- Compact End\n");
+      printf("   %d pages, %zu object bytes, next at %zu\n", vm.heap.pageCount, vm.heap.cellBytes, vm.nextGC);
+    }
   #endif
 }
 
 void freeObjects() {
-  Object* object = vm.objects;
-  while (object != NULL) {
-    Object* next = object->next;
-    freeObject(object);
-    object = next;
-  }
-
+  freeHeap(&vm.heap);
   free(vm.grayStack);
 }
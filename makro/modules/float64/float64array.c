@@ -0,0 +1,345 @@
+#include <math.h>
+
+#include "../../include/float64array.h"
+#include "../../include/object.h"
+#include "../../include/vm.h"
+
+// The kernels are written once against a small set of lane operations:
+// four doubles per step with AVX, two with SSE2 (always available on
+// x86-64), and a scalar fallback elsewhere. Loads and stores are unaligned,
+// so arrays need no particular alignment.
+#if defined(__AVX__)
+#include <immintrin.h>
+
+typedef __m256d Lanes;
+#define LANE_COUNT 4
+#define lanesLoad(pointer) _mm256_loadu_pd(pointer)
+#define lanesStore(pointer, lanes) _mm256_storeu_pd(pointer, lanes)
+#define lanesSplat(value) _mm256_set1_pd(value)
+#define lanesAdd(a, b) _mm256_add_pd(a, b)
+#define lanesMul(a, b) _mm256_mul_pd(a, b)
+#define lanesMin(a, b) _mm256_or_pd(_mm256_min_pd(a, b), _mm256_min_pd(b, a))
+#define lanesMax(a, b) _mm256_or_pd(_mm256_and_pd(_mm256_max_pd(a, b), _mm256_max_pd(b, a)), _mm256_cmp_pd(a, b, _CMP_UNORD_Q))
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+
+typedef __m128d Lanes;
+#define LANE_COUNT 2
+#define lanesLoad(pointer) _mm_loadu_pd(pointer)
+#define lanesStore(pointer, lanes) _mm_storeu_pd(pointer, lanes)
+#define lanesSplat(value) _mm_set1_pd(value)
+#define lanesAdd(a, b) _mm_add_pd(a, b)
+#define lanesMul(a, b) _mm_mul_pd(a, b)
+#define lanesMin(a, b) _mm_or_pd(_mm_min_pd(a, b), _mm_min_pd(b, a))
+#define lanesMax(a, b) _mm_or_pd(_mm_and_pd(_mm_max_pd(a, b), _mm_max_pd(b, a)), _mm_cmpunord_pd(a, b))
+#else
+typedef double Lanes;
+#define LANE_COUNT 1
+#define lanesLoad(pointer) (*(pointer))
+#define lanesStore(pointer, lanes) (*(pointer) = (lanes))
+#define lanesSplat(value) (value)
+#define lanesAdd(a, b) ((a) + (b))
+#define lanesMul(a, b) ((a) * (b))
+#define lanesMin(a, b) minOf(a, b)
+#define lanesMax(a, b) maxOf(a, b)
+#endif
+
+// A NaN item makes the result NaN, and -0 counts as less than 0, so min and
+// max do not depend on the order items are combined in. The lane versions
+// above get the same results by combining the operands both ways round:
+// minpd and maxpd return their second operand for NaNs and equal zeros.
+static inline double minOf(double a, double b) {
+  if (a != a || b != b) return a + b;
+  if (a == b) return signbit(a) ? a : b;
+  return a < b ? a : b;
+}
+
+static inline double maxOf(double a, double b) {
+  if (a != a || b != b) return a + b;
+  if (a == b) return signbit(a) ? b : a;
+  return a > b ? a : b;
+}
+
+typedef enum {
+  REDUCE_SUM,
+  REDUCE_MIN,
+  REDUCE_MAX
+} Reduction;
+
+static double reduceLanes(Lanes lanes, Reduction reduction) {
+  double values[LANE_COUNT];
+  lanesStore(values, lanes);
+
+  double result = values[0];
+  for (int i = 1; i < LANE_COUNT; i++) {
+    switch (reduction) {
+      case REDUCE_SUM: result += values[i]; break;
+      case REDUCE_MIN: result = minOf(result, values[i]); break;
+      case REDUCE_MAX: result = maxOf(result, values[i]); break;
+    }
+  }
+
+  return result;
+}
+
+static void addKernel(double* dest, const double* a, const double* b, int length) {
+  int i = 0;
+  for (; i + LANE_COUNT <= length; i += LANE_COUNT) {
+    lanesStore(dest + i, lanesAdd(lanesLoad(a + i), lanesLoad(b + i)));
+  }
+
+  for (; i < length; i++) dest[i] = a[i] + b[i];
+}
+
+static void mulKernel(double* dest, const double* a, const double* b, int length) {
+  int i = 0;
+  for (; i + LANE_COUNT <= length; i += LANE_COUNT) {
+    lanesStore(dest + i, lanesMul(lanesLoad(a + i), lanesLoad(b + i)));
+  }
+
+  for (; i < length; i++) dest[i] = a[i] * b[i];
+}
+
+static void scaleKernel(double* dest, const double* a, double factor, int length) {
+  Lanes factors = lanesSplat(factor);
+
+  int i = 0;
+  for (; i + LANE_COUNT <= length; i += LANE_COUNT) {
+    lanesStore(dest + i, lanesMul(lanesLoad(a + i), factors));
+  }
+
+  for (; i < length; i++) dest[i] = a[i] * factor;
+}
+
+static void fillKernel(double* dest, double value, int length) {
+  Lanes values = lanesSplat(value);
+
+  int i = 0;
+  for (; i + LANE_COUNT <= length; i += LANE_COUNT) {
+    lanesStore(dest + i, values);
+  }
+
+  for (; i < length; i++) dest[i] = value;
+}
+
+// Sums are kept as SUM_PARTIALS partial sums, element i going to partial
+// i % SUM_PARTIALS, which are then added pairwise in a fixed order. Every
+// lane width therefore adds in the same order and gets the same result,
+// and the independent accumulators keep the adder pipeline busy.
+#define SUM_PARTIALS 8
+#define SUM_GROUPS (SUM_PARTIALS / LANE_COUNT)
+
+static double combinePartials(Lanes* groups) {
+  double partials[SUM_PARTIALS];
+  for (int group = 0; group < SUM_GROUPS; group++) lanesStore(partials + group * LANE_COUNT, groups[group]);
+
+  for (int width = SUM_PARTIALS / 2; width > 0; width /= 2) {
+    for (int i = 0; i < width; i++) partials[i] += partials[i + width];
+  }
+
+  return partials[0];
+}
+
+static double sumKernel(const double* a, int length) {
+  Lanes groups[SUM_GROUPS];
+  for (int group = 0; group < SUM_GROUPS; group++) groups[group] = lanesSplat(0.0);
+
+  int i = 0;
+  for (; i + SUM_PARTIALS <= length; i += SUM_PARTIALS) {
+    for (int group = 0; group < SUM_GROUPS; group++) {
+      groups[group] = lanesAdd(groups[group], lanesLoad(a + i + group * LANE_COUNT));
+    }
+  }
+
+  double sum = combinePartials(groups);
+  for (; i < length; i++) sum += a[i];
+  return sum;
+}
+
+static double dotKernel(const double* a, const double* b, int length) {
+  Lanes groups[SUM_GROUPS];
+  for (int group = 0; group < SUM_GROUPS; group++) groups[group] = lanesSplat(0.0);
+
+  int i = 0;
+  for (; i + SUM_PARTIALS <= length; i += SUM_PARTIALS) {
+    for (int group = 0; group < SUM_GROUPS; group++) {
+      int offset = i + group * LANE_COUNT;
+      groups[group] = lanesAdd(groups[group], lanesMul(lanesLoad(a + offset), lanesLoad(b + offset)));
+    }
+  }
+
+  double sum = combinePartials(groups);
+  for (; i < length; i++) sum += a[i] * b[i];
+  return sum;
+}
+
+// Requires length > 0.
+static double extremeKernel(const double* a, int length, Reduction reduction) {
+  if (length < LANE_COUNT) {
+    double result = a[0];
+    for (int i = 1; i < length; i++) {
+      result = reduction == REDUCE_MIN ? minOf(result, a[i]) : maxOf(result, a[i]);
+    }
+
+    return result;
+  }
+
+  Lanes result = lanesLoad(a);
+
+  int i = LANE_COUNT;
+  for (; i + LANE_COUNT <= length; i += LANE_COUNT) {
+    Lanes lanes = lanesLoad(a + i);
+    result = reduction == REDUCE_MIN ? lanesMin(result, lanes) : lanesMax(result, lanes);
+  }
+
+  // The last, possibly overlapping, group covers the tail.
+  Lanes tail = lanesLoad(a + length - LANE_COUNT);
+  result = reduction == REDUCE_MIN ? lanesMin(result, tail) : lanesMax(result, tail);
+  return reduceLanes(result, reduction);
+}
+
+// Each output depends on the previous one, so this stays a scalar loop.
+static void prefixSumKernel(double* dest, const double* a, int length) {
+  double sum = 0;
+  for (int i = 0; i < length; i++) {
+    sum += a[i];
+    dest[i] = sum;
+  }
+}
+
+static void checkArity(int argCount, int arity, const char* function) {
+  if (argCount != arity) {
+    throwRuntimeError("%s() expects %d arguments but got %d", function, arity, argCount);
+  }
+}
+
+static ObjectFloat64Array* arrayArgument(Value value, const char* function) {
+  if (!IS_FLOAT64_ARRAY(value)) throwRuntimeError("%s() expects a Float64Array", function);
+  return AS_FLOAT64_ARRAY(value);
+}
+
+static double numberArgument(Value value, const char* function) {
+  if (!IS_NUMERIC(value)) throwRuntimeError("%s() expects a number", function);
+  return AS_NUMERIC(value);
+}
+
+static void checkSameLength(ObjectFloat64Array* a, ObjectFloat64Array* b, const char* function) {
+  if (a->length != b->length) {
+    throwRuntimeError("%s() expects arrays of equal length but got %d and %d", function, a->length, b->length);
+  }
+}
+
+// Float64Array(length) returns a zeroed array; Float64Array(list) copies
+// a list of numbers.
+Value float64ArrayNative(int argCount, Value* args) {
+  checkArity(argCount, 1, "Float64Array");
+
+  if (IS_NUMERIC(args[0])) {
+    double length = AS_NUMERIC(args[0]);
+    if (!(length >= 0 && length <= INT32_MAX) || (int)length != length) {
+      throwRuntimeError("Float64Array() length must be a non-negative integer");
+    }
+
+    ObjectFloat64Array* array = newFloat64Array((int)length);
+    fillKernel(array->values, 0.0, array->length);
+    return OBJECT_VAL(array);
+  }
+
+  if (!IS_LIST(args[0])) throwRuntimeError("Float64Array() expects a length or a list");
+
+  ObjectList* list = AS_LIST(args[0]);
+  ObjectFloat64Array* array = newFloat64Array(list->items.count);
+
+  for (int i = 0; i < array->length; i++) {
+    if (!IS_NUMERIC(list->items.values[i])) throwRuntimeError("Float64Array() items must be numbers");
+    array->values[i] = AS_NUMERIC(list->items.values[i]);
+  }
+
+  return OBJECT_VAL(array);
+}
+
+// f64Add(a, b) and f64Mul(a, b) return a new array of elementwise results.
+Value f64AddNative(int argCount, Value* args) {
+  checkArity(argCount, 2, "f64Add");
+  ObjectFloat64Array* a = arrayArgument(args[0], "f64Add");
+  ObjectFloat64Array* b = arrayArgument(args[1], "f64Add");
+  checkSameLength(a, b, "f64Add");
+
+  ObjectFloat64Array* result = newFloat64Array(a->length);
+  addKernel(result->values, a->values, b->values, a->length);
+  return OBJECT_VAL(result);
+}
+
+Value f64MulNative(int argCount, Value* args) {
+  checkArity(argCount, 2, "f64Mul");
+  ObjectFloat64Array* a = arrayArgument(args[0], "f64Mul");
+  ObjectFloat64Array* b = arrayArgument(args[1], "f64Mul");
+  checkSameLength(a, b, "f64Mul");
+
+  ObjectFloat64Array* result = newFloat64Array(a->length);
+  mulKernel(result->values, a->values, b->values, a->length);
+  return OBJECT_VAL(result);
+}
+
+// f64Scale(a, factor) returns a new array of a's items times factor.
+Value f64ScaleNative(int argCount, Value* args) {
+  checkArity(argCount, 2, "f64Scale");
+  ObjectFloat64Array* a = arrayArgument(args[0], "f64Scale");
+  double factor = numberArgument(args[1], "f64Scale");
+
+  ObjectFloat64Array* result = newFloat64Array(a->length);
+  scaleKernel(result->values, a->values, factor, a->length);
+  return OBJECT_VAL(result);
+}
+
+Value f64SumNative(int argCount, Value* args) {
+  checkArity(argCount, 1, "f64Sum");
+  ObjectFloat64Array* a = arrayArgument(args[0], "f64Sum");
+
+  return NUMBER_VAL(sumKernel(a->values, a->length));
+}
+
+Value f64DotNative(int argCount, Value* args) {
+  checkArity(argCount, 2, "f64Dot");
+  ObjectFloat64Array* a = arrayArgument(args[0], "f64Dot");
+  ObjectFloat64Array* b = arrayArgument(args[1], "f64Dot");
+  checkSameLength(a, b, "f64Dot");
+
+  return NUMBER_VAL(dotKernel(a->values, b->values, a->length));
+}
+
+Value f64MinNative(int argCount, Value* args) {
+  checkArity(argCount, 1, "f64Min");
+  ObjectFloat64Array* a = arrayArgument(args[0], "f64Min");
+  if (a->length == 0) throwRuntimeError("f64Min() of an empty array");
+
+  return NUMBER_VAL(extremeKernel(a->values, a->length, REDUCE_MIN));
+}
+
+Value f64MaxNative(int argCount, Value* args) {
+  checkArity(argCount, 1, "f64Max");
+  ObjectFloat64Array* a = arrayArgument(args[0], "f64Max");
+  if (a->length == 0) throwRuntimeError("f64Max() of an empty array");
+
+  return NUMBER_VAL(extremeKernel(a->values, a->length, REDUCE_MAX));
+}
+
+// f64PrefixSum(a) returns a new array of running totals.
+Value f64PrefixSumNative(int argCount, Value* args) {
+  checkArity(argCount, 1, "f64PrefixSum");
+  ObjectFloat64Array* a = arrayArgument(args[0], "f64PrefixSum");
+
+  ObjectFloat64Array* result = newFloat64Array(a->length);
+  prefixSumKernel(result->values, a->values, a->length);
+  return OBJECT_VAL(result);
+}
+
+// f64Fill(a, value) sets every item of a in place and returns a.
+Value f64FillNative(int argCount, Value* args) {
+  checkArity(argCount, 2, "f64Fill");
+  ObjectFloat64Array* a = arrayArgument(args[0], "f64Fill");
+  double value = numberArgument(args[1], "f64Fill");
+
+  fillKernel(a->values, value, a->length);
+  return args[0];
+}
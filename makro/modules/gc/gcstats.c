@@ -0,0 +1,61 @@
+#include <string.h>
+
+#include "../../include/gcstats.h"
+#include "../../include/memory.h"
+#include "../../include/object.h"
+#include "../../include/vm.h"
+
+static ObjectInstance* newStatsInstance(const char* className) {
+  ObjectString* name = copyString(className, (int)strlen(className));
+  push(OBJECT_VAL(name));
+  ObjectClass* _class = newClass(name);
+  push(OBJECT_VAL(_class));
+  ObjectInstance* instance = newInstance(_class);
+  pop();
+  pop();
+  return instance;
+}
+
+// The instance being filled in must already be on the stack.
+static void setField(ObjectInstance* instance, const char* name, Value value) {
+  push(value);
+  push(OBJECT_VAL(copyString(name, (int)strlen(name))));
+  tableSet(&instance->fields, AS_STRING(vm.stackTop[-1]), value);
+  pop();
+  pop();
+}
+
+Value gcStatsNative(int argCount, Value* args) {
+  GCStats* stats = &vm.gcStats;
+
+  ObjectInstance* result = newStatsInstance("GCStats");
+  push(OBJECT_VAL(result));
+
+  setField(result, "collections", INTEGER_VAL(stats->collections));
+  setField(result, "compactions", INTEGER_VAL(stats->compactions));
+  setField(result, "totalPause", NUMBER_VAL(stats->totalPauseNanos / 1e9));
+  setField(result, "maxPause", NUMBER_VAL(stats->maxPauseNanos / 1e9));
+  setField(result, "bytesAllocated", INTEGER_VAL((int64_t)stats->totalAllocated));
+  setField(result, "bytesFreed", INTEGER_VAL((int64_t)stats->totalFreed));
+  setField(result, "heapBytes", INTEGER_VAL((int64_t)vm.bytesAllocated));
+  setField(result, "nextGC", INTEGER_VAL((int64_t)vm.nextGC));
+
+  ObjectInstance* live = newStatsInstance("GCLiveBytes");
+  push(OBJECT_VAL(live));
+  for (int i = 0; i < OBJECT_TYPE_COUNT; i++) {
+    setField(live, objectTypeName((ObjectType)i), INTEGER_VAL((int64_t)stats->liveBytes[i]));
+  }
+  setField(result, "liveBytes", OBJECT_VAL(live));
+  pop();
+
+  ObjectInstance* pauses = newStatsInstance("GCPauses");
+  push(OBJECT_VAL(pauses));
+  for (int i = 0; i < GC_PAUSE_BUCKETS; i++) {
+    setField(pauses, pauseBucketName(i), INTEGER_VAL(stats->pauseHistogram[i]));
+  }
+  setField(result, "pauses", OBJECT_VAL(pauses));
+  pop();
+
+  pop();
+  return OBJECT_VAL(result);
+}
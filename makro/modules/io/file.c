@@ -0,0 +1,478 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <setjmp.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "../../include/file.h"
+#include "../../include/heap.h"
+#include "../../include/memory.h"
+#include "../../include/object.h"
+#include "../../include/vm.h"
+
+// Reads are served from a buffer refilled this many bytes at a time, and
+// larger reads go straight into their destination.
+#define FILE_INPUT_SIZE (64 * 1024)
+
+// readFile() maps files at least this large instead of copying them.
+#define FILE_MAP_MIN_SIZE (64 * 1024)
+
+static void checkArity(int argCount, int arity, const char* function) {
+  if (argCount != arity) {
+    throwRuntimeError("%s() expects %d arguments but got %d", function, arity, argCount);
+  }
+}
+
+static ObjectString* stringArgument(Value* slot, const char* function) {
+  if (IS_ROPE(*slot)) *slot = OBJECT_VAL(flattenRope(AS_ROPE(*slot)));
+  if (!IS_STRING(*slot)) throwRuntimeError("%s() expects a string", function);
+  return AS_STRING(*slot);
+}
+
+// Copies a path argument into path, which holds PATH_MAX bytes, and
+// terminates it.
+static void pathArgument(Value* slot, char* path, const char* function) {
+  ObjectString* string = stringArgument(slot, function);
+  if (string->length >= PATH_MAX || memchr(string->chars, '\0', string->length) != NULL) {
+    throwRuntimeError("%s() path is invalid", function);
+  }
+
+  memcpy(path, string->chars, string->length);
+  path[string->length] = '\0';
+}
+
+static ObjectFile* fileArgument(Value value, const char* function) {
+  if (!IS_FILE(value)) throwRuntimeError("%s() expects a file", function);
+
+  ObjectFile* file = AS_FILE(value);
+  if (file->fd < 0) throwRuntimeError("%s() on a closed file", function);
+  return file;
+}
+
+static ObjectFile* readerArgument(Value value, const char* function) {
+  ObjectFile* file = fileArgument(value, function);
+  if (!file->readable) throwRuntimeError("%s() expects a file opened for reading", function);
+  return file;
+}
+
+static ObjectFile* writerArgument(Value value, const char* function) {
+  ObjectFile* file = fileArgument(value, function);
+  if (!file->writable) throwRuntimeError("%s() expects a file opened for writing", function);
+  return file;
+}
+
+static int countArgument(Value value, const char* function) {
+  if (!IS_NUMERIC(value)) throwRuntimeError("%s() expects a numeric count", function);
+
+  double count = AS_NUMERIC(value);
+  if (!(count >= 0 && count <= INT32_MAX) || (int)count != count) {
+    throwRuntimeError("%s() count must be a non-negative integer", function);
+  }
+
+  return (int)count;
+}
+
+// Returns the number of bytes read, or 0 at end of file.
+static size_t readSome(ObjectFile* file, char* dest, size_t length) {
+  for (;;) {
+    ssize_t bytesRead = read(file->fd, dest, length);
+    if (bytesRead >= 0) {
+      if (bytesRead == 0) file->eof = true;
+      return (size_t)bytesRead;
+    }
+
+    if (errno != EINTR) throwRuntimeError("Could not read file");
+  }
+}
+
+// Reads another block after whatever is still buffered, first moving that
+// to the front and growing the buffer if it is full. Returns false at end
+// of file.
+static bool fillInput(ObjectFile* file) {
+  if (file->eof) return false;
+
+  size_t buffered = file->inputEnd - file->inputStart;
+  if (file->inputStart > 0) {
+    memmove(file->input, file->input + file->inputStart, buffered);
+    file->inputStart = 0;
+    file->inputEnd = buffered;
+  }
+
+  if (file->inputEnd == file->inputCapacity) {
+    size_t capacity = file->inputCapacity < FILE_INPUT_SIZE ? FILE_INPUT_SIZE : file->inputCapacity * 2;
+    char* input = (char*)realloc(file->input, capacity);
+    if (input == NULL) throwRuntimeError("Not enough memory to read file");
+
+    file->input = input;
+    file->inputCapacity = capacity;
+  }
+
+  size_t bytesRead = readSome(file, file->input + file->inputEnd, file->inputCapacity - file->inputEnd);
+  file->inputEnd += bytesRead;
+  return bytesRead > 0;
+}
+
+// Copies up to length bytes into dest and returns how many there were.
+// Small reads go through the input buffer; once a read has at least a
+// whole block left to fill it bypasses the buffer.
+static size_t readInput(ObjectFile* file, char* dest, size_t length) {
+  size_t total = 0;
+
+  while (total < length) {
+    size_t buffered = file->inputEnd - file->inputStart;
+    if (buffered > 0) {
+      size_t count = buffered < length - total ? buffered : length - total;
+      memcpy(dest + total, file->input + file->inputStart, count);
+      file->inputStart += count;
+      total += count;
+    } else if (length - total >= FILE_INPUT_SIZE) {
+      if (file->eof) break;
+      size_t bytesRead = readSome(file, dest + total, length - total);
+      if (bytesRead == 0) break;
+      total += bytesRead;
+    } else if (!fillInput(file)) {
+      break;
+    }
+  }
+
+  return total;
+}
+
+// Wraps a read-only mapping of length bytes in a string without copying.
+static ObjectString* mappedString(char* chars, int length) {
+  ObjectSource* source = newSource(chars, length, true);
+  push(OBJECT_VAL(source));
+  ObjectString* string = newBorrowedString((Object*)source, chars, length);
+  pop();
+  return string;
+}
+
+// Reads the rest of fd into a new string and closes it. Used for pipes and
+// for files too small to be worth a mapping.
+static ObjectString* readWhole(int fd, size_t sizeHint, const char* path) {
+  size_t capacity = sizeHint < 4096 ? 4096 : sizeHint + 1;
+  size_t length = 0;
+  char* chars = (char*)malloc(capacity);
+
+  for (;;) {
+    if (chars != NULL && length == capacity) {
+      capacity *= 2;
+      char* grown = (char*)realloc(chars, capacity);
+      if (grown == NULL) free(chars);
+      chars = grown;
+    }
+
+    if (chars == NULL) {
+      close(fd);
+      throwRuntimeError("Not enough memory to read file \"%s\"", path);
+    }
+
+    ssize_t bytesRead = read(fd, chars + length, capacity - length);
+    if (bytesRead < 0 && errno == EINTR) continue;
+
+    if (bytesRead < 0 || length + (size_t)bytesRead > INT_MAX - 1) {
+      free(chars);
+      close(fd);
+      throwRuntimeError(bytesRead < 0 ? "Could not read file \"%s\"" : "File \"%s\" is too large", path);
+    }
+
+    if (bytesRead == 0) break;
+    length += (size_t)bytesRead;
+  }
+
+  close(fd);
+
+  // The string can still run into the heap limit, so chars is freed before
+  // that error unwinds past this function.
+  jmp_buf handler;
+  jmp_buf* outer = vm.errorHandler;
+  if (setjmp(handler) != 0) {
+    free(chars);
+    rethrowRuntimeError(outer);
+  }
+
+  vm.errorHandler = &handler;
+  ObjectString* string = allocateString((int)length);
+  vm.errorHandler = outer;
+
+  memcpy(string->chars, chars, length);
+  free(chars);
+  return string;
+}
+
+// openFile(path, mode) opens path for reading ("r"), writing from scratch
+// ("w") or appending ("a").
+Value openFileNative(int argCount, Value* args) {
+  checkArity(argCount, 2, "openFile");
+  char path[PATH_MAX];
+  pathArgument(&args[0], path, "openFile");
+  ObjectString* mode = stringArgument(&args[1], "openFile");
+
+  int flags;
+  if (mode->length == 1 && mode->chars[0] == 'r') {
+    flags = O_RDONLY;
+  } else if (mode->length == 1 && mode->chars[0] == 'w') {
+    flags = O_WRONLY | O_CREAT | O_TRUNC;
+  } else if (mode->length == 1 && mode->chars[0] == 'a') {
+    flags = O_WRONLY | O_CREAT | O_APPEND;
+  } else {
+    throwRuntimeError("openFile() mode must be \"r\", \"w\" or \"a\"");
+  }
+
+  ObjectFile* file = newFile();
+  file->fd = open(path, flags | O_CLOEXEC, 0666);
+
+  // Unreachable files that have not been swept yet may be holding the
+  // descriptors, so a full collection can free some up.
+  if (file->fd < 0 && (errno == EMFILE || errno == ENFILE)) {
+    push(OBJECT_VAL(file));
+    collectGarbage();
+    heapFinishSweep(&vm.heap);
+    pop();
+    file->fd = open(path, flags | O_CLOEXEC, 0666);
+  }
+
+  if (file->fd < 0) throwRuntimeError("Could not open file \"%s\"", path);
+
+  file->readable = flags == O_RDONLY;
+  file->writable = !file->readable;
+  file->output.fd = file->fd;
+  return OBJECT_VAL(file);
+}
+
+// close(file) writes out anything buffered and closes file. Files that are
+// never closed are closed when they are collected.
+Value closeNative(int argCount, Value* args) {
+  checkArity(argCount, 1, "close");
+  ObjectFile* file = fileArgument(args[0], "close");
+
+  bool written = flushOutput(&file->output);
+  freeOutput(&file->output);
+  free(file->input);
+  file->input = NULL;
+  file->inputStart = 0;
+  file->inputEnd = 0;
+  file->inputCapacity = 0;
+
+  if (close(file->fd) != 0 && file->writable) written = false;
+  file->fd = -1;
+  file->output.fd = OUTPUT_MEMORY;
+
+  if (!written) throwRuntimeError("Could not write file");
+  return NULL_VAL;
+}
+
+// readFile(path) returns the whole of path as a string. Large files are
+// mapped rather than read, so the string costs no copy and its pages are
+// only loaded as they are touched.
+Value readFileNative(int argCount, Value* args) {
+  checkArity(argCount, 1, "readFile");
+  char path[PATH_MAX];
+  pathArgument(&args[0], path, "readFile");
+
+  int fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0) throwRuntimeError("Could not open file \"%s\"", path);
+
+  struct stat info;
+  bool regular = fstat(fd, &info) == 0 && S_ISREG(info.st_mode);
+  if (!regular || info.st_size < FILE_MAP_MIN_SIZE) {
+    return OBJECT_VAL(readWhole(fd, regular ? (size_t)info.st_size : 0, path));
+  }
+
+  if (info.st_size > INT_MAX - 1) {
+    close(fd);
+    throwRuntimeError("File \"%s\" is too large", path);
+  }
+
+  void* chars = mmap(NULL, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (chars == MAP_FAILED) throwRuntimeError("Could not map file \"%s\"", path);
+
+  madvise(chars, (size_t)info.st_size, MADV_SEQUENTIAL);
+  return OBJECT_VAL(mappedString((char*)chars, (int)info.st_size));
+}
+
+// Finds the next line of file in its input buffer and consumes it. The
+// span leaves out the "\n" or "\r\n" and stays valid until the next read
+// from file. Returns false at end of file.
+bool readLineSpan(ObjectFile* file, const char** line, size_t* length) {
+  size_t scanned = 0;
+  size_t consumed;
+
+  for (;;) {
+    const char* start = file->input + file->inputStart;
+    size_t buffered = file->inputEnd - file->inputStart;
+
+    const char* newline = buffered > scanned ? (const char*)memchr(start + scanned, '\n', buffered - scanned) : NULL;
+    if (newline != NULL) {
+      *length = (size_t)(newline - start);
+      consumed = *length + 1;
+      break;
+    }
+
+    scanned = buffered;
+    if (!fillInput(file)) {
+      if (buffered == 0) return false;
+      *length = buffered;
+      consumed = buffered;
+      break;
+    }
+  }
+
+  *line = file->input + file->inputStart;
+  file->inputStart += consumed;
+  if (*length > 0 && (*line)[*length - 1] == '\r') (*length)--;
+  return true;
+}
+
+// Allocates a heap object with room for size bytes and points bytes at them.
+typedef Object* (*ReadTarget)(size_t size, char** bytes);
+
+static Object* stringTarget(size_t size, char** bytes) {
+  ObjectString* string = allocateString((int)size);
+  *bytes = string->chars;
+  return (Object*)string;
+}
+
+static Object* float64Target(size_t size, char** bytes) {
+  ObjectFloat64Array* array = newFloat64Array((int)(size / sizeof(double)));
+  *bytes = (char*)array->values;
+  return (Object*)array;
+}
+
+// Returns how many bytes file can be expected to yield: what is buffered
+// plus the rest of a regular file, or plus one block of anything else.
+static size_t expectedInput(ObjectFile* file) {
+  size_t expected = file->inputEnd - file->inputStart;
+
+  struct stat info;
+  off_t offset;
+  if (fstat(file->fd, &info) == 0 && S_ISREG(info.st_mode) && (offset = lseek(file->fd, 0, SEEK_CUR)) >= 0) {
+    if (info.st_size > offset) expected += (size_t)(info.st_size - offset);
+  } else {
+    expected += FILE_INPUT_SIZE;
+  }
+
+  return expected;
+}
+
+// Reads up to count bytes, a multiple of unit, into an object made by
+// allocate and stores how many arrived in length. The object starts at the
+// expected input rather than at count and only grows while data keeps
+// coming, so asking for far more than a file holds commits no more heap
+// than the file does.
+static Object* readUpTo(ObjectFile* file, size_t count, size_t unit, ReadTarget allocate, size_t* length) {
+  size_t size = (expectedInput(file) + unit - 1) / unit * unit;
+  if (size > count) size = count;
+
+  char* bytes;
+  Object* target = allocate(size, &bytes);
+  size_t filled = readInput(file, bytes, size);
+
+  while (filled == size && size < count && !file->eof) {
+    size_t grown = size < FILE_INPUT_SIZE / 2 ? FILE_INPUT_SIZE : size * 2;
+    if (grown > count) grown = count;
+
+    char* grownBytes;
+    push(OBJECT_VAL(target));
+    Object* larger = allocate(grown, &grownBytes);
+    pop();
+
+    memcpy(grownBytes, bytes, filled);
+    target = larger;
+    bytes = grownBytes;
+    size = grown;
+    filled += readInput(file, bytes + filled, size - filled);
+  }
+
+  *length = filled;
+  return target;
+}
+
+// readLine(file) returns the next line, or null at end of file. Lines are
+// cut from the input buffer, so reading a file takes one read(2) per
+// block rather than per line.
+Value readLineNative(int argCount, Value* args) {
+  checkArity(argCount, 1, "readLine");
+  ObjectFile* file = readerArgument(args[0], "readLine");
+
+  const char* chars;
+  size_t length;
+  if (!readLineSpan(file, &chars, &length)) return NULL_VAL;
+  if (length > INT_MAX - 1) throwRuntimeError("readLine() line is too long");
+
+  ObjectString* line = allocateString((int)length);
+  memcpy(line->chars, chars, length);
+  return OBJECT_VAL(line);
+}
+
+// readBytes(file, count) returns a string of the next count bytes, fewer
+// at the end of the file, or null once nothing is left.
+Value readBytesNative(int argCount, Value* args) {
+  checkArity(argCount, 2, "readBytes");
+  ObjectFile* file = readerArgument(args[0], "readBytes");
+  int count = countArgument(args[1], "readBytes");
+
+  size_t length;
+  ObjectString* bytes = (ObjectString*)readUpTo(file, (size_t)count, 1, stringTarget, &length);
+  if (length == 0 && count > 0) return NULL_VAL;
+  if (length == (size_t)bytes->length) return OBJECT_VAL(bytes);
+
+  push(OBJECT_VAL(bytes));
+  ObjectString* shorter = allocateString((int)length);
+  memcpy(shorter->chars, bytes->chars, length);
+  pop();
+  return OBJECT_VAL(shorter);
+}
+
+// readFloat64s(file, count) returns a Float64Array of the next count raw
+// doubles in native byte order, fewer at the end of the file, or null once
+// nothing is left.
+Value readFloat64sNative(int argCount, Value* args) {
+  checkArity(argCount, 2, "readFloat64s");
+  ObjectFile* file = readerArgument(args[0], "readFloat64s");
+  int count = countArgument(args[1], "readFloat64s");
+
+  size_t length;
+  ObjectFloat64Array* array = (ObjectFloat64Array*)readUpTo(file, (size_t)count * sizeof(double), sizeof(double), float64Target, &length);
+  if (length % sizeof(double) != 0) throwRuntimeError("readFloat64s() file ends partway through a number");
+
+  int read = (int)(length / sizeof(double));
+  if (read == 0 && count > 0) return NULL_VAL;
+  if (read == array->length) return OBJECT_VAL(array);
+
+  push(OBJECT_VAL(array));
+  ObjectFloat64Array* shorter = newFloat64Array(read);
+  memcpy(shorter->values, array->values, length);
+  pop();
+  return OBJECT_VAL(shorter);
+}
+
+// write(file, value) writes value the way print shows it, without a
+// newline. Output is buffered until the buffer fills, flush(file) or
+// close(file).
+Value writeNative(int argCount, Value* args) {
+  checkArity(argCount, 2, "write");
+  ObjectFile* file = writerArgument(args[0], "write");
+
+  writeValue(&file->output, args[1]);
+  if (file->output.failed) throwRuntimeError("Could not write file");
+  return NULL_VAL;
+}
+
+// writeFloat64s(file, array) writes the raw doubles of array in native
+// byte order, the format readFloat64s() reads.
+Value writeFloat64sNative(int argCount, Value* args) {
+  checkArity(argCount, 2, "writeFloat64s");
+  ObjectFile* file = writerArgument(args[0], "writeFloat64s");
+  if (!IS_FLOAT64_ARRAY(args[1])) throwRuntimeError("writeFloat64s() expects a Float64Array");
+
+  ObjectFloat64Array* array = AS_FLOAT64_ARRAY(args[1]);
+  writeOutput(&file->output, (const char*)array->values, (size_t)array->length * sizeof(double));
+  if (file->output.failed) throwRuntimeError("Could not write file");
+  return NULL_VAL;
+}
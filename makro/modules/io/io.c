@@ -0,0 +1,20 @@
+#include "../../include/io.h"
+#include "../../include/object.h"
+#include "../../include/vm.h"
+
+// flush() writes out everything printed so far; flush(file) writes out
+// what is buffered for file.
+Value flushNative(int argCount, Value* args) {
+  if (argCount > 1) throwRuntimeError("flush() expects 0 or 1 arguments but got %d", argCount);
+  if (argCount == 0) {
+    if (!flushOutput(&vm.output)) throwRuntimeError("Could not write output");
+    return NULL_VAL;
+  }
+
+  if (!IS_FILE(args[0])) throwRuntimeError("flush() expects a file");
+  ObjectFile* file = AS_FILE(args[0]);
+  if (file->fd < 0) throwRuntimeError("flush() on a closed file");
+  if (!flushOutput(&file->output)) throwRuntimeError("Could not write file");
+
+  return NULL_VAL;
+}
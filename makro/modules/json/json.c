@@ -0,0 +1,724 @@
+#include <limits.h>
+#include <math.h>
+#include <string.h>
+
+#include "../../include/file.h"
+#include "../../include/json.h"
+#include "../../include/memory.h"
+#include "../../include/number.h"
+#include "../../include/object.h"
+#include "../../include/vm.h"
+
+// Strings and whitespace are scanned a block of bytes at a time: 32 with
+// AVX2, 16 with SSE2, one at a time elsewhere.
+#if defined(__AVX2__)
+#include <immintrin.h>
+
+typedef __m256i Bytes;
+#define BYTE_LANES 32
+#define LANE_BITS 0xFFFFFFFFu
+#define bytesLoad(pointer) _mm256_loadu_si256((const __m256i*)(pointer))
+#define bytesSplat(byte) _mm256_set1_epi8(byte)
+#define bytesEqual(a, b) _mm256_cmpeq_epi8(a, b)
+#define bytesOr(a, b) _mm256_or_si256(a, b)
+#define bytesMax(a, b) _mm256_max_epu8(a, b)
+#define bytesMask(a) ((uint32_t)_mm256_movemask_epi8(a))
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+
+typedef __m128i Bytes;
+#define BYTE_LANES 16
+#define LANE_BITS 0xFFFFu
+#define bytesLoad(pointer) _mm_loadu_si128((const __m128i*)(pointer))
+#define bytesSplat(byte) _mm_set1_epi8(byte)
+#define bytesEqual(a, b) _mm_cmpeq_epi8(a, b)
+#define bytesOr(a, b) _mm_or_si128(a, b)
+#define bytesMax(a, b) _mm_max_epu8(a, b)
+#define bytesMask(a) ((uint32_t)_mm_movemask_epi8(a))
+#endif
+
+#define JSON_MAX_DEPTH 512
+#define NAME_CACHE_BITS 8
+#define NAME_CACHE_SIZE (1 << NAME_CACHE_BITS)
+
+// Scratch space above this is given back after use.
+#define SCRATCH_KEEP_SIZE (1024 * 1024)
+
+// Returns the offset of the first quote, backslash or control character in
+// chars, or length if there is none. These are the bytes that end or
+// escape a string when parsing, and the ones stringify has to escape.
+static size_t scanString(const char* chars, size_t length) {
+  size_t i = 0;
+
+#ifdef BYTE_LANES
+  Bytes quote = bytesSplat('"');
+  Bytes backslash = bytesSplat('\\');
+  Bytes control = bytesSplat(0x1F);
+
+  for (; i + BYTE_LANES <= length; i += BYTE_LANES) {
+    Bytes block = bytesLoad(chars + i);
+    Bytes special = bytesOr(bytesOr(bytesEqual(block, quote), bytesEqual(block, backslash)),
+                            bytesEqual(bytesMax(block, control), control));
+
+    uint32_t mask = bytesMask(special);
+    if (mask != 0) return i + __builtin_ctz(mask);
+  }
+#endif
+
+  for (; i < length; i++) {
+    unsigned char c = (unsigned char)chars[i];
+    if (c == '"' || c == '\\' || c < 0x20) return i;
+  }
+
+  return length;
+}
+
+static inline bool isWhitespace(char c) {
+  return c == ' ' || c == '\n' || c == '\r' || c == '\t';
+}
+
+static inline bool isDigit(char c) {
+  return c >= '0' && c <= '9';
+}
+
+// Returns the offset of the first byte that is not whitespace, or length.
+// Most gaps are empty or a single space, so a few bytes are checked one at
+// a time before switching to whole blocks for indentation.
+static size_t skipWhitespace(const char* chars, size_t length) {
+  size_t i = 0;
+  for (; i < length && i < 4; i++) {
+    if (!isWhitespace(chars[i])) return i;
+  }
+
+#ifdef BYTE_LANES
+  Bytes space = bytesSplat(' ');
+  Bytes newline = bytesSplat('\n');
+  Bytes carriageReturn = bytesSplat('\r');
+  Bytes tab = bytesSplat('\t');
+
+  for (; i + BYTE_LANES <= length; i += BYTE_LANES) {
+    Bytes block = bytesLoad(chars + i);
+    Bytes blank = bytesOr(bytesOr(bytesEqual(block, space), bytesEqual(block, newline)),
+                          bytesOr(bytesEqual(block, carriageReturn), bytesEqual(block, tab)));
+
+    uint32_t other = ~bytesMask(blank) & LANE_BITS;
+    if (other != 0) return i + __builtin_ctz(other);
+  }
+#endif
+
+  for (; i < length; i++) {
+    if (!isWhitespace(chars[i])) return i;
+  }
+
+  return length;
+}
+
+// Decoded strings and stringify output are built here. It lives outside
+// the heap and is reused, so a runtime error part way through leaks nothing.
+static OutputBuffer* scratchBuffer() {
+  static OutputBuffer buffer;
+  static bool initialized = false;
+
+  if (!initialized) {
+    initOutput(&buffer, OUTPUT_MEMORY, 0);
+    initialized = true;
+  }
+
+  flushOutput(&buffer);
+  return &buffer;
+}
+
+static void trimScratch(OutputBuffer* buffer) {
+  if (buffer->capacity > SCRATCH_KEEP_SIZE) setOutputSize(buffer, 0);
+}
+
+// Object keys repeat from one record to the next, so their interned names
+// are kept in a small direct-mapped cache in front of the intern set. The
+// entries are only trusted until the next collection or compaction, which
+// may free or move them.
+typedef struct {
+  ObjectString* names[NAME_CACHE_SIZE];
+  int collections;
+  int compactions;
+} NameCache;
+
+static NameCache nameCache;
+
+static uint32_t nameSlot(const char* chars, size_t length) {
+  uint64_t head = 0;
+  uint64_t tail = 0;
+  memcpy(&head, chars, length < 8 ? length : 8);
+  if (length > 8) memcpy(&tail, chars + length - 8, 8);
+
+  uint64_t mixed = (head ^ (tail * 0x9E3779B97F4A7C15ull) ^ length) * 0xFF51AFD7ED558CCDull;
+  return (uint32_t)(mixed >> (64 - NAME_CACHE_BITS));
+}
+
+static ObjectString* internName(const char* chars, size_t length) {
+  if (nameCache.collections != vm.gcStats.collections || nameCache.compactions != vm.gcStats.compactions) {
+    memset(nameCache.names, 0, sizeof(nameCache.names));
+    nameCache.collections = vm.gcStats.collections;
+    nameCache.compactions = vm.gcStats.compactions;
+  }
+
+  uint32_t slot = nameSlot(chars, length);
+  ObjectString* name = nameCache.names[slot];
+  if (name != NULL && (size_t)name->length == length && memcmp(name->chars, chars, length) == 0) return name;
+
+  name = copyString(chars, (int)length);
+  nameCache.names[slot] = name;
+  return name;
+}
+
+typedef struct {
+  const char* chars;
+  size_t length;
+  size_t current;
+  ObjectString* source;
+  ObjectList* roots;
+  int depth;
+  const char* function;
+} JsonParser;
+
+static _Noreturn void parseError(JsonParser* parser, const char* message) {
+  throwRuntimeError("%s() %s at offset %zu", parser->function, message, parser->current);
+}
+
+static void skipParserWhitespace(JsonParser* parser) {
+  parser->current += skipWhitespace(parser->chars + parser->current, parser->length - parser->current);
+}
+
+// Returns the next byte, or '\0' at the end of the input.
+static char peekByte(JsonParser* parser) {
+  return parser->current < parser->length ? parser->chars[parser->current] : '\0';
+}
+
+// Reserves a slot on the parser's root list. Reserving it before the
+// object that goes in it exists lets the list grow, and so collect, while
+// nothing is unrooted.
+static int addRoot(JsonParser* parser) {
+  writeValueArray(&parser->roots->items, NULL_VAL);
+  return parser->roots->items.count - 1;
+}
+
+static ObjectString* newString(JsonParser* parser, const char* chars, size_t length, bool isKey) {
+  if (length > INT_MAX - 1) parseError(parser, "string is too long");
+  if (isKey) return internName(chars, length);
+
+  ObjectString* string = allocateString((int)length);
+  memcpy(string->chars, chars, length);
+  return string;
+}
+
+static uint32_t parseHex(JsonParser* parser, size_t start) {
+  if (start + 4 > parser->length) parseError(parser, "truncated \\u escape");
+
+  uint32_t code = 0;
+  for (size_t i = start; i < start + 4; i++) {
+    char c = parser->chars[i];
+    int digit = isDigit(c) ? c - '0' : (c >= 'a' && c <= 'f') ? c - 'a' + 10 : (c >= 'A' && c <= 'F') ? c - 'A' + 10 : -1;
+    if (digit < 0) parseError(parser, "invalid \\u escape");
+    code = code * 16 + (uint32_t)digit;
+  }
+
+  return code;
+}
+
+static void writeUtf8(OutputBuffer* output, uint32_t code) {
+  char bytes[4];
+  int length;
+
+  if (code < 0x80) {
+    bytes[0] = (char)code;
+    length = 1;
+  } else if (code < 0x800) {
+    bytes[0] = (char)(0xC0 | (code >> 6));
+    bytes[1] = (char)(0x80 | (code & 0x3F));
+    length = 2;
+  } else if (code < 0x10000) {
+    bytes[0] = (char)(0xE0 | (code >> 12));
+    bytes[1] = (char)(0x80 | ((code >> 6) & 0x3F));
+    bytes[2] = (char)(0x80 | (code & 0x3F));
+    length = 3;
+  } else {
+    bytes[0] = (char)(0xF0 | (code >> 18));
+    bytes[1] = (char)(0x80 | ((code >> 12) & 0x3F));
+    bytes[2] = (char)(0x80 | ((code >> 6) & 0x3F));
+    bytes[3] = (char)(0x80 | (code & 0x3F));
+    length = 4;
+  }
+
+  writeOutput(output, bytes, length);
+}
+
+// Decodes a string with escapes into the scratch buffer, starting from its
+// first character. Surrogate pairs become one UTF-8 sequence and a lone
+// surrogate becomes U+FFFD.
+static ObjectString* parseEscapedString(JsonParser* parser, size_t start, bool isKey) {
+  OutputBuffer* decoded = scratchBuffer();
+  const char* chars = parser->chars;
+  size_t i = start;
+
+  for (;;) {
+    size_t run = scanString(chars + i, parser->length - i);
+    writeOutput(decoded, chars + i, run);
+    i += run;
+
+    parser->current = i;
+    if (i == parser->length) parseError(parser, "unterminated string");
+    if (chars[i] == '"') break;
+    if ((unsigned char)chars[i] < 0x20) parseError(parser, "control character in string");
+    if (i + 1 == parser->length) parseError(parser, "unterminated string");
+
+    char escape = chars[i + 1];
+    i += 2;
+
+    switch (escape) {
+      case '"': case '\\': case '/': writeOutput(decoded, &escape, 1); break;
+      case 'b': WRITE_LITERAL(decoded, "\b"); break;
+      case 'f': WRITE_LITERAL(decoded, "\f"); break;
+      case 'n': WRITE_LITERAL(decoded, "\n"); break;
+      case 'r': WRITE_LITERAL(decoded, "\r"); break;
+      case 't': WRITE_LITERAL(decoded, "\t"); break;
+      case 'u': {
+        uint32_t code = parseHex(parser, i);
+        i += 4;
+
+        if (code >= 0xD800 && code < 0xDC00 && i + 6 <= parser->length && chars[i] == '\\' && chars[i + 1] == 'u') {
+          uint32_t low = parseHex(parser, i + 2);
+          if (low >= 0xDC00 && low < 0xE000) {
+            code = 0x10000 + ((code - 0xD800) << 10) + (low - 0xDC00);
+            i += 6;
+          }
+        }
+
+        if (code >= 0xD800 && code < 0xE000) code = 0xFFFD;
+        writeUtf8(decoded, code);
+        break;
+      }
+      default:
+        parser->current = i - 1;
+        parseError(parser, "invalid escape");
+    }
+  }
+
+  parser->current = i + 1;
+  if (decoded->failed) throwRuntimeError("Not enough memory to decode string");
+  return newString(parser, decoded->bytes, decoded->count, isKey);
+}
+
+// Strings without escapes, the common case, are found with one scan. When
+// parsing a string value the result is a view of the input where that
+// avoids a copy.
+static ObjectString* parseString(JsonParser* parser, bool isKey) {
+  size_t start = parser->current + 1;
+  size_t end = start + scanString(parser->chars + start, parser->length - start);
+  if (end == parser->length || parser->chars[end] != '"') return parseEscapedString(parser, start, isKey);
+
+  parser->current = end + 1;
+  if (!isKey && parser->source != NULL) {
+    return newStringView(parser->source, (int)start, (int)(end - start));
+  }
+
+  return newString(parser, parser->chars + start, end - start, isKey);
+}
+
+// Integers that fit in 64 bits stay integers, as they do in source code;
+// anything with a fraction or exponent, and -0, becomes a double.
+static Value parseNumberValue(JsonParser* parser) {
+  const char* chars = parser->chars;
+  size_t start = parser->current;
+  size_t i = start;
+
+  bool negative = i < parser->length && chars[i] == '-';
+  if (negative) i++;
+  if (i == parser->length || !isDigit(chars[i])) parseError(parser, "invalid number");
+
+  // Accumulated as a negative number so INT64_MIN fits.
+  int64_t integer = 0;
+  bool overflow = false;
+
+  if (chars[i] == '0') {
+    i++;
+  } else {
+    for (; i < parser->length && isDigit(chars[i]); i++) {
+      if (!overflow && (__builtin_mul_overflow(integer, 10, &integer) || __builtin_sub_overflow(integer, chars[i] - '0', &integer))) {
+        overflow = true;
+      }
+    }
+  }
+
+  bool integral = true;
+
+  if (i < parser->length && chars[i] == '.') {
+    i++;
+    parser->current = i;
+    if (i == parser->length || !isDigit(chars[i])) parseError(parser, "invalid number");
+    while (i < parser->length && isDigit(chars[i])) i++;
+    integral = false;
+  }
+
+  if (i < parser->length && (chars[i] == 'e' || chars[i] == 'E')) {
+    i++;
+    if (i < parser->length && (chars[i] == '+' || chars[i] == '-')) i++;
+    parser->current = i;
+    if (i == parser->length || !isDigit(chars[i])) parseError(parser, "invalid number");
+    while (i < parser->length && isDigit(chars[i])) i++;
+    integral = false;
+  }
+
+  parser->current = i;
+
+  if (integral && !overflow) {
+    if (negative && integer != 0) return INTEGER_VAL(integer);
+    if (!negative && integer != INT64_MIN) return INTEGER_VAL(-integer);
+  }
+
+  if (i - start > INT_MAX) parseError(parser, "number is too long");
+
+  double number;
+  parseNumber(chars + start, (int)(i - start), &number);
+  return NUMBER_VAL(number);
+}
+
+static Value parseLiteral(JsonParser* parser, const char* text, size_t length, Value value) {
+  if (parser->length - parser->current < length || memcmp(parser->chars + parser->current, text, length) != 0) {
+    parseError(parser, "unexpected character");
+  }
+
+  parser->current += length;
+  return value;
+}
+
+static Value parseValue(JsonParser* parser);
+
+static void enterNesting(JsonParser* parser) {
+  if (++parser->depth > JSON_MAX_DEPTH) parseError(parser, "nesting is too deep");
+  parser->current++;
+}
+
+static Value parseArray(JsonParser* parser) {
+  enterNesting(parser);
+
+  int slot = addRoot(parser);
+  ObjectList* list = newList();
+  parser->roots->items.values[slot] = OBJECT_VAL(list);
+
+  skipParserWhitespace(parser);
+  if (peekByte(parser) == ']') {
+    parser->current++;
+  } else {
+    for (;;) {
+      Value item = parseValue(parser);
+      push(item);
+      writeValueArray(&list->items, item);
+      pop();
+
+      skipParserWhitespace(parser);
+      char next = peekByte(parser);
+      parser->current++;
+      if (next == ']') break;
+      if (next != ',') {
+        parser->current--;
+        parseError(parser, "expected ',' or ']'");
+      }
+    }
+  }
+
+  parser->roots->items.count--;
+  parser->depth--;
+  return OBJECT_VAL(list);
+}
+
+// Objects become instances of JsonObject, one field per key.
+static Value parseObject(JsonParser* parser) {
+  enterNesting(parser);
+
+  int slot = addRoot(parser);
+  int keySlot = addRoot(parser);
+  ObjectInstance* instance = newInstance(vm.jsonClass);
+  parser->roots->items.values[slot] = OBJECT_VAL(instance);
+
+  skipParserWhitespace(parser);
+  if (peekByte(parser) == '}') {
+    parser->current++;
+  } else {
+    for (;;) {
+      skipParserWhitespace(parser);
+      if (peekByte(parser) != '"') parseError(parser, "expected a string key");
+
+      ObjectString* key = parseString(parser, true);
+      parser->roots->items.values[keySlot] = OBJECT_VAL(key);
+
+      skipParserWhitespace(parser);
+      if (peekByte(parser) != ':') parseError(parser, "expected ':'");
+      parser->current++;
+
+      Value value = parseValue(parser);
+      push(value);
+      tableSet(&instance->fields, key, value);
+      pop();
+
+      skipParserWhitespace(parser);
+      char next = peekByte(parser);
+      parser->current++;
+      if (next == '}') break;
+      if (next != ',') {
+        parser->current--;
+        parseError(parser, "expected ',' or '}'");
+      }
+    }
+  }
+
+  parser->roots->items.count -= 2;
+  parser->depth--;
+  return OBJECT_VAL(instance);
+}
+
+// The result is unrooted; the caller must keep it reachable before
+// allocating again.
+static Value parseValue(JsonParser* parser) {
+  skipParserWhitespace(parser);
+
+  switch (peekByte(parser)) {
+    case '{': return parseObject(parser);
+    case '[': return parseArray(parser);
+    case '"': return OBJECT_VAL(parseString(parser, false));
+    case 't': return parseLiteral(parser, "true", 4, BOOL_VAL(true));
+    case 'f': return parseLiteral(parser, "false", 5, BOOL_VAL(false));
+    case 'n': return parseLiteral(parser, "null", 4, NULL_VAL);
+    case '-':
+    case '0': case '1': case '2': case '3': case '4':
+    case '5': case '6': case '7': case '8': case '9':
+      return parseNumberValue(parser);
+    case '\0':
+      if (parser->current == parser->length) parseError(parser, "unexpected end of input");
+      // Fall through.
+    default:
+      parseError(parser, "unexpected character");
+  }
+}
+
+// Parses one complete document from chars. source, if not NULL, is the
+// string chars belongs to.
+static Value parseDocument(const char* chars, size_t length, ObjectString* source, const char* function) {
+  JsonParser parser;
+  parser.chars = chars;
+  parser.length = length;
+  parser.current = 0;
+  parser.source = source;
+  parser.depth = 0;
+  parser.function = function;
+
+  parser.roots = newList();
+  push(OBJECT_VAL(parser.roots));
+
+  Value result = parseValue(&parser);
+  skipParserWhitespace(&parser);
+  if (parser.current != parser.length) parseError(&parser, "unexpected trailing characters");
+
+  pop();
+  return result;
+}
+
+static void writeEscaped(OutputBuffer* output, const char* chars, size_t length) {
+  static const char hexDigits[] = "0123456789abcdef";
+
+  size_t i = 0;
+  while (i < length) {
+    size_t run = scanString(chars + i, length - i);
+    writeOutput(output, chars + i, run);
+    i += run;
+    if (i == length) break;
+
+    unsigned char c = (unsigned char)chars[i++];
+    switch (c) {
+      case '"': WRITE_LITERAL(output, "\\\""); break;
+      case '\\': WRITE_LITERAL(output, "\\\\"); break;
+      case '\b': WRITE_LITERAL(output, "\\b"); break;
+      case '\f': WRITE_LITERAL(output, "\\f"); break;
+      case '\n': WRITE_LITERAL(output, "\\n"); break;
+      case '\r': WRITE_LITERAL(output, "\\r"); break;
+      case '\t': WRITE_LITERAL(output, "\\t"); break;
+      default: {
+        char escape[6] = { '\\', 'u', '0', '0', hexDigits[c >> 4], hexDigits[c & 0xF] };
+        writeOutput(output, escape, sizeof(escape));
+        break;
+      }
+    }
+  }
+}
+
+static void writeEscapedPiece(ObjectString* piece, void* context) {
+  writeEscaped((OutputBuffer*)context, piece->chars, piece->length);
+}
+
+static void writeString(OutputBuffer* output, ObjectString* string) {
+  WRITE_LITERAL(output, "\"");
+  writeEscaped(output, string->chars, string->length);
+  WRITE_LITERAL(output, "\"");
+}
+
+// Writes value as JSON. Nothing here allocates on the heap, so no
+// collection can run part way through. Non-finite numbers become null.
+static void writeJson(OutputBuffer* output, Value value, int depth, const char* function) {
+  if (IS_NUMBER(value) && !isfinite(AS_NUMBER(value))) {
+    WRITE_LITERAL(output, "null");
+    return;
+  }
+
+  if (!IS_OBJECT(value)) {
+    writeValue(output, value);
+    return;
+  }
+
+  if (depth == JSON_MAX_DEPTH) throwRuntimeError("%s() value is nested too deeply or is cyclic", function);
+
+  switch (OBJECT_TYPE(value)) {
+    case OBJECT_STRING:
+      writeString(output, AS_STRING(value));
+      break;
+    case OBJECT_ROPE:
+      WRITE_LITERAL(output, "\"");
+      forEachRopePiece(AS_ROPE(value), writeEscapedPiece, output);
+      WRITE_LITERAL(output, "\"");
+      break;
+    case OBJECT_LIST: {
+      ValueArray* items = &AS_LIST(value)->items;
+      WRITE_LITERAL(output, "[");
+      for (int i = 0; i < items->count; i++) {
+        if (i > 0) WRITE_LITERAL(output, ",");
+        writeJson(output, items->values[i], depth + 1, function);
+      }
+      WRITE_LITERAL(output, "]");
+      break;
+    }
+    case OBJECT_FLOAT64_ARRAY: {
+      ObjectFloat64Array* array = AS_FLOAT64_ARRAY(value);
+      WRITE_LITERAL(output, "[");
+      for (int i = 0; i < array->length; i++) {
+        if (i > 0) WRITE_LITERAL(output, ",");
+        writeJson(output, NUMBER_VAL(array->values[i]), depth + 1, function);
+      }
+      WRITE_LITERAL(output, "]");
+      break;
+    }
+    case OBJECT_MAP: {
+      Map* map = &AS_MAP(value)->map;
+      bool first = true;
+      WRITE_LITERAL(output, "{");
+      for (int i = 0; i < map->entryCount; i++) {
+        MapEntry* entry = &map->entries[i];
+        if (entry->deleted) continue;
+
+        if (!first) WRITE_LITERAL(output, ",");
+        first = false;
+
+        if (IS_STRING(entry->key)) {
+          writeString(output, AS_STRING(entry->key));
+        } else if (IS_NUMERIC(entry->key)) {
+          WRITE_LITERAL(output, "\"");
+          writeValue(output, entry->key);
+          WRITE_LITERAL(output, "\"");
+        } else {
+          throwRuntimeError("%s() map keys must be strings or numbers", function);
+        }
+
+        WRITE_LITERAL(output, ":");
+        writeJson(output, entry->value, depth + 1, function);
+      }
+      WRITE_LITERAL(output, "}");
+      break;
+    }
+    case OBJECT_INSTANCE: {
+      Table* fields = &AS_INSTANCE(value)->fields;
+      bool first = true;
+      WRITE_LITERAL(output, "{");
+      for (int i = 0; i < fields->capacity; i++) {
+        Entry* entry = &fields->entries[i];
+        if (entry->key == NULL) continue;
+
+        if (!first) WRITE_LITERAL(output, ",");
+        first = false;
+
+        writeString(output, entry->key);
+        WRITE_LITERAL(output, ":");
+        writeJson(output, entry->value, depth + 1, function);
+      }
+      WRITE_LITERAL(output, "}");
+      break;
+    }
+    default:
+      throwRuntimeError("%s() cannot encode %s values", function, objectTypeName(OBJECT_TYPE(value)));
+  }
+}
+
+static void checkArity(int argCount, int arity, const char* function) {
+  if (argCount != arity) {
+    throwRuntimeError("%s() expects %d arguments but got %d", function, arity, argCount);
+  }
+}
+
+static ObjectFile* fileArgument(Value value, bool writing, const char* function) {
+  if (!IS_FILE(value)) throwRuntimeError("%s() expects a file", function);
+
+  ObjectFile* file = AS_FILE(value);
+  if (file->fd < 0 || (writing ? !file->writable : !file->readable)) {
+    throwRuntimeError("%s() expects a file open for %s", function, writing ? "writing" : "reading");
+  }
+
+  return file;
+}
+
+// jsonParse(text) returns the value text encodes. Objects become
+// JsonObject instances and arrays become lists.
+Value jsonParseNative(int argCount, Value* args) {
+  checkArity(argCount, 1, "jsonParse");
+  if (IS_ROPE(args[0])) args[0] = OBJECT_VAL(flattenRope(AS_ROPE(args[0])));
+  if (!IS_STRING(args[0])) throwRuntimeError("jsonParse() expects a string");
+
+  ObjectString* text = AS_STRING(args[0]);
+  return parseDocument(text->chars, text->length, text, "jsonParse");
+}
+
+// jsonStringify(value) returns value encoded as compact JSON.
+Value jsonStringifyNative(int argCount, Value* args) {
+  checkArity(argCount, 1, "jsonStringify");
+
+  OutputBuffer* output = scratchBuffer();
+  writeJson(output, args[0], 0, "jsonStringify");
+  if (output->failed || output->count > INT_MAX - 1) throwRuntimeError("jsonStringify() result is too large");
+
+  ObjectString* result = allocateString((int)output->count);
+  memcpy(result->chars, output->bytes, output->count);
+  trimScratch(output);
+  return OBJECT_VAL(result);
+}
+
+// jsonRead(file) parses the next record of a newline-delimited JSON file,
+// skipping blank lines, or returns null at the end of the file. Each
+// record is parsed straight out of the file's input buffer.
+Value jsonReadNative(int argCount, Value* args) {
+  checkArity(argCount, 1, "jsonRead");
+  ObjectFile* file = fileArgument(args[0], false, "jsonRead");
+
+  const char* line;
+  size_t length;
+  do {
+    if (!readLineSpan(file, &line, &length)) return NULL_VAL;
+  } while (skipWhitespace(line, length) == length);
+
+  return parseDocument(line, length, NULL, "jsonRead");
+}
+
+// jsonWrite(file, value) writes value as one line of newline-delimited
+// JSON, encoding it straight into the file's output buffer.
+Value jsonWriteNative(int argCount, Value* args) {
+  checkArity(argCount, 2, "jsonWrite");
+  ObjectFile* file = fileArgument(args[0], true, "jsonWrite");
+
+  writeJson(&file->output, args[1], 0, "jsonWrite");
+  WRITE_LITERAL(&file->output, "\n");
+  if (file->output.failed) throwRuntimeError("Could not write file");
+  return NULL_VAL;
+}
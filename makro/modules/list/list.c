@@ -0,0 +1,91 @@
+#include "../../include/list.h"
+#include "../../include/object.h"
+#include "../../include/stringbuilder.h"
+#include "../../include/vm.h"
+
+static ObjectList* listArgument(Value value, const char* function) {
+  if (!IS_LIST(value)) throwRuntimeError("%s() expects a list", function);
+  return AS_LIST(value);
+}
+
+static void checkArity(int argCount, int arity, const char* function) {
+  if (argCount != arity) {
+    throwRuntimeError("%s() expects %d arguments but got %d", function, arity, argCount);
+  }
+}
+
+// Accepts an integer position in [0, count].
+static int boundArgument(Value value, int count, const char* function) {
+  if (!IS_NUMERIC(value)) throwRuntimeError("%s() expects numeric bounds", function);
+
+  double number = AS_NUMERIC(value);
+  if (!(number >= 0 && number <= count) || (int)number != number) {
+    throwRuntimeError("%s() bound out of range", function);
+  }
+
+  return (int)number;
+}
+
+// append(list, value) adds value to the end of list and returns the list.
+// append(builder, string) adds the characters of string to a string
+// builder and returns the builder.
+Value appendNative(int argCount, Value* args) {
+  checkArity(argCount, 2, "append");
+
+  if (IS_STRING_BUILDER(args[0])) {
+    if (!IS_STRING_LIKE(args[1])) throwRuntimeError("append() to a string builder expects a string");
+    if (IS_ROPE(args[1])) args[1] = OBJECT_VAL(flattenRope(AS_ROPE(args[1])));
+
+    builderAppend(AS_STRING_BUILDER(args[0]), AS_STRING(args[1])->chars, AS_STRING(args[1])->length);
+    return args[0];
+  }
+
+  ObjectList* list = listArgument(args[0], "append");
+
+  writeValueArray(&list->items, args[1]);
+  return args[0];
+}
+
+// pop(list) removes and returns the last item of list.
+Value popNative(int argCount, Value* args) {
+  checkArity(argCount, 1, "pop");
+  ObjectList* list = listArgument(args[0], "pop");
+
+  if (list->items.count == 0) throwRuntimeError("pop() from an empty list");
+  return list->items.values[--list->items.count];
+}
+
+// length(value) returns the number of items in a list, Float64Array or
+// map, or the number of characters in a string or string builder.
+Value lengthNative(int argCount, Value* args) {
+  checkArity(argCount, 1, "length");
+
+  if (IS_LIST(args[0])) return INTEGER_VAL(AS_LIST(args[0])->items.count);
+  if (IS_FLOAT64_ARRAY(args[0])) return INTEGER_VAL(AS_FLOAT64_ARRAY(args[0])->length);
+  if (IS_MAP(args[0])) return INTEGER_VAL(AS_MAP(args[0])->map.count);
+  if (IS_STRING(args[0])) return INTEGER_VAL(AS_STRING(args[0])->length);
+  if (IS_ROPE(args[0])) return INTEGER_VAL(AS_ROPE(args[0])->length);
+  if (IS_STRING_BUILDER(args[0])) return INTEGER_VAL(AS_STRING_BUILDER(args[0])->length);
+
+  throwRuntimeError("length() expects a list, an array, a map or a string");
+}
+
+// slice(list, start, end) returns a new list holding items [start, end).
+Value sliceNative(int argCount, Value* args) {
+  checkArity(argCount, 3, "slice");
+  ObjectList* list = listArgument(args[0], "slice");
+
+  int start = boundArgument(args[1], list->items.count, "slice");
+  int end = boundArgument(args[2], list->items.count, "slice");
+  if (start > end) throwRuntimeError("slice() start is past its end");
+
+  ObjectList* result = newList();
+  push(OBJECT_VAL(result));
+
+  for (int i = start; i < end; i++) {
+    writeValueArray(&result->items, list->items.values[i]);
+  }
+
+  pop();
+  return OBJECT_VAL(result);
+}
@@ -0,0 +1,101 @@
+#include "../../include/mapnatives.h"
+#include "../../include/object.h"
+#include "../../include/vm.h"
+
+static void checkArity(int argCount, int arity, const char* function) {
+  if (argCount != arity) {
+    throwRuntimeError("%s() expects %d arguments but got %d", function, arity, argCount);
+  }
+}
+
+static Map* mapArgument(Value value, const char* function) {
+  if (!IS_MAP(value)) throwRuntimeError("%s() expects a map", function);
+  return &AS_MAP(value)->map;
+}
+
+// Flattens a rope key in its argument slot, which keeps the result rooted.
+static Value keyArgument(Value* slot, const char* function) {
+  if (IS_ROPE(*slot)) *slot = OBJECT_VAL(flattenRope(AS_ROPE(*slot)));
+  if (IS_NUMBER(*slot) && AS_NUMBER(*slot) != AS_NUMBER(*slot)) {
+    throwRuntimeError("%s() key cannot be NaN", function);
+  }
+
+  return *slot;
+}
+
+// Collects the keys or the values of a map into a new list, in insertion
+// order.
+static Value collectEntries(Map* map, bool keys) {
+  ObjectList* list = newList();
+  push(OBJECT_VAL(list));
+
+  for (int i = 0; i < map->entryCount; i++) {
+    MapEntry* entry = &map->entries[i];
+    if (!entry->deleted) writeValueArray(&list->items, keys ? entry->key : entry->value);
+  }
+
+  pop();
+  return OBJECT_VAL(list);
+}
+
+// Map() returns a new, empty map.
+Value mapNative(int argCount, Value* args) {
+  (void)args;
+  checkArity(argCount, 0, "Map");
+
+  return OBJECT_VAL(newMap());
+}
+
+// mapGet(map, key) returns the value stored under key, or null if there is
+// none. Indexing with map[key] raises an error instead.
+Value mapGetNative(int argCount, Value* args) {
+  checkArity(argCount, 2, "mapGet");
+  Map* map = mapArgument(args[0], "mapGet");
+  Value key = keyArgument(&args[1], "mapGet");
+
+  Value value;
+  return mapGet(map, key, &value) ? value : NULL_VAL;
+}
+
+// mapSet(map, key, value) stores value under key and returns the map.
+Value mapSetNative(int argCount, Value* args) {
+  checkArity(argCount, 3, "mapSet");
+  Map* map = mapArgument(args[0], "mapSet");
+  Value key = keyArgument(&args[1], "mapSet");
+
+  mapSet(map, key, args[2]);
+  return args[0];
+}
+
+Value mapHasNative(int argCount, Value* args) {
+  checkArity(argCount, 2, "mapHas");
+  Map* map = mapArgument(args[0], "mapHas");
+  Value key = keyArgument(&args[1], "mapHas");
+
+  Value value;
+  return BOOL_VAL(mapGet(map, key, &value));
+}
+
+// mapDelete(map, key) removes key and returns whether it was present.
+Value mapDeleteNative(int argCount, Value* args) {
+  checkArity(argCount, 2, "mapDelete");
+  Map* map = mapArgument(args[0], "mapDelete");
+  Value key = keyArgument(&args[1], "mapDelete");
+
+  return BOOL_VAL(mapDelete(map, key));
+}
+
+Value mapSizeNative(int argCount, Value* args) {
+  checkArity(argCount, 1, "mapSize");
+  return INTEGER_VAL(mapArgument(args[0], "mapSize")->count);
+}
+
+Value mapKeysNative(int argCount, Value* args) {
+  checkArity(argCount, 1, "mapKeys");
+  return collectEntries(mapArgument(args[0], "mapKeys"), true);
+}
+
+Value mapValuesNative(int argCount, Value* args) {
+  checkArity(argCount, 1, "mapValues");
+  return collectEntries(mapArgument(args[0], "mapValues"), false);
+}
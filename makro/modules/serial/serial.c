@@ -0,0 +1,745 @@
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../../include/map.h"
+#include "../../include/memory.h"
+#include "../../include/object.h"
+#include "../../include/serial.h"
+#include "../../include/table.h"
+#include "../../include/vm.h"
+
+// A serialized value is a four byte magic, the number of strings and
+// objects it holds as a 32-bit count, then the value. Each value starts
+// with a tag byte:
+//
+//   NULL, FALSE, TRUE
+//   INTEGER        zigzag varint
+//   NUMBER         8 bytes
+//   STRING         varint length, bytes
+//   LIST           varint count, count values
+//   MAP            varint count, count key and value pairs
+//   INSTANCE       class name, varint count, count name and value pairs
+//   FLOAT64_ARRAY  varint count, count doubles
+//   REFERENCE      varint index of a string or object written earlier
+//
+// Strings and objects are numbered in the order they first appear and
+// every later appearance is a reference, so shared objects stay shared
+// and cycles survive the trip. An instance takes its number before its
+// class name. Doubles and the count are in host byte order, the way
+// writeFloat64s() writes them.
+typedef enum {
+  TAG_NULL,
+  TAG_FALSE,
+  TAG_TRUE,
+  TAG_INTEGER,
+  TAG_NUMBER,
+  TAG_STRING,
+  TAG_LIST,
+  TAG_MAP,
+  TAG_INSTANCE,
+  TAG_FLOAT64_ARRAY,
+  TAG_REFERENCE,
+} Tag;
+
+static const char serialMagic[4] = { 'M', 'K', 'S', 1 };
+
+#define HEADER_SIZE 8
+
+// Strings up to this long are matched by content rather than identity,
+// so field names and repeated values are written once.
+#define STRING_MATCH_LENGTH 256
+
+// Scratch space above these sizes is given back after use.
+#define SCRATCH_KEEP_SIZE (1024 * 1024)
+#define SEEN_KEEP_CAPACITY (64 * 1024)
+
+// The encoded bytes are built here before being copied into the result.
+// It lives outside the heap and is reused, so a runtime error part way
+// through leaks nothing.
+static OutputBuffer* scratchBuffer() {
+  static OutputBuffer buffer;
+  static bool initialized = false;
+
+  if (!initialized) {
+    initOutput(&buffer, OUTPUT_MEMORY, 0);
+    initialized = true;
+  }
+
+  flushOutput(&buffer);
+  return &buffer;
+}
+
+// Every string and object written is numbered by its position in
+// visited. Short strings are matched by content through the seen set;
+// anything else by identity. The first visit to an object sets
+// OBJECT_VISITED in its header, so only an object that has been written
+// before needs its number looked up. Objects join the seen set once the
+// first such repeat turns up, which means a graph without shared objects
+// never hashes them at all. Nothing is allocated on the heap while
+// encoding, so the pointers stay valid and no collection sees the flag.
+typedef struct {
+  Object** objects;
+  uint32_t count;
+  uint32_t capacity;
+} VisitedList;
+
+static VisitedList visited;
+
+// Entries left from earlier calls belong to an older generation and count
+// as empty, so the set is never cleared between calls.
+typedef struct {
+  Object* object;
+  uint32_t hash;
+  uint32_t index;
+  uint32_t generation;
+} SeenEntry;
+
+typedef struct {
+  SeenEntry* entries;
+  uint32_t capacity;
+  uint32_t count;
+  uint32_t generation;
+  bool holdsObjects;
+} SeenSet;
+
+static SeenSet seen;
+
+static void beginVisit() {
+  visited.count = 0;
+  seen.count = 0;
+  seen.holdsObjects = false;
+  if (++seen.generation != 0) return;
+
+  // After 2^32 calls the generations wrap around.
+  if (seen.entries != NULL) memset(seen.entries, 0, sizeof(SeenEntry) * seen.capacity);
+  seen.generation = 1;
+}
+
+// Clears OBJECT_VISITED again. This has to happen before any runtime
+// error is thrown while encoding.
+static void endVisit() {
+  for (uint32_t i = 0; i < visited.count; i++) visited.objects[i]->gcBits &= ~OBJECT_VISITED;
+  visited.count = 0;
+
+  if (visited.capacity > SEEN_KEEP_CAPACITY) {
+    free(visited.objects);
+    visited.objects = NULL;
+    visited.capacity = 0;
+  }
+
+  if (seen.capacity > SEEN_KEEP_CAPACITY) {
+    free(seen.entries);
+    seen.entries = NULL;
+    seen.capacity = 0;
+  }
+}
+
+static _Noreturn void outOfMemory(const char* function) {
+  endVisit();
+  throwRuntimeError("Not enough memory to %s value", function);
+}
+
+static bool matchesByContent(Object* object) {
+  return object->type == OBJECT_STRING && ((ObjectString*)object)->length <= STRING_MATCH_LENGTH;
+}
+
+static uint32_t seenHash(Object* object) {
+  if (matchesByContent(object)) return stringHash((ObjectString*)object);
+  return (uint32_t)(((uintptr_t)object * 0x9E3779B97F4A7C15ull) >> 32);
+}
+
+static bool sameObject(Object* a, Object* b) {
+  if (a == b) return true;
+  return matchesByContent(a) && matchesByContent(b) && stringsEqual((ObjectString*)a, (ObjectString*)b);
+}
+
+static void growSeen() {
+  uint32_t capacity = seen.capacity < 1024 ? 1024 : seen.capacity * 2;
+  SeenEntry* entries = (SeenEntry*)calloc(capacity, sizeof(SeenEntry));
+  if (entries == NULL) outOfMemory("serialize");
+
+  for (uint32_t i = 0; i < seen.capacity; i++) {
+    SeenEntry* entry = &seen.entries[i];
+    if (entry->generation != seen.generation) continue;
+
+    uint32_t slot = entry->hash & (capacity - 1);
+    while (entries[slot].generation == seen.generation) slot = (slot + 1) & (capacity - 1);
+    entries[slot] = *entry;
+  }
+
+  free(seen.entries);
+  seen.entries = entries;
+  seen.capacity = capacity;
+}
+
+// Returns true with the number object was given if the seen set has it.
+// Otherwise adds it under newIndex and returns false.
+static bool findSeen(Object* object, uint32_t newIndex, uint32_t* index) {
+  if ((seen.count + 1) * 2 > seen.capacity) growSeen();
+
+  uint32_t hash = seenHash(object);
+  uint32_t mask = seen.capacity - 1;
+
+  for (uint32_t slot = hash & mask;; slot = (slot + 1) & mask) {
+    SeenEntry* entry = &seen.entries[slot];
+
+    if (entry->generation != seen.generation) {
+      entry->object = object;
+      entry->hash = hash;
+      entry->index = newIndex;
+      entry->generation = seen.generation;
+      seen.count++;
+      return false;
+    }
+
+    if (entry->hash == hash && sameObject(entry->object, object)) {
+      *index = entry->index;
+      return true;
+    }
+  }
+}
+
+static void addVisited(Object* object) {
+  if (visited.count == visited.capacity) {
+    uint32_t capacity = visited.capacity < 1024 ? 1024 : visited.capacity * 2;
+    Object** objects = (Object**)realloc(visited.objects, sizeof(Object*) * capacity);
+    if (objects == NULL) outOfMemory("serialize");
+
+    visited.objects = objects;
+    visited.capacity = capacity;
+  }
+
+  visited.objects[visited.count++] = object;
+}
+
+// Returns true with the number object was given if it has been written
+// before. Otherwise gives it the next number and returns false.
+static bool seenBefore(Object* object, uint32_t* index) {
+  if (matchesByContent(object)) {
+    if (findSeen(object, visited.count, index)) return true;
+  } else if (object->gcBits & OBJECT_VISITED) {
+    if (!seen.holdsObjects) {
+      seen.holdsObjects = true;
+      for (uint32_t i = 0; i < visited.count; i++) {
+        if (!matchesByContent(visited.objects[i])) findSeen(visited.objects[i], i, index);
+      }
+    }
+
+    findSeen(object, 0, index);
+    return true;
+  } else {
+    object->gcBits |= OBJECT_VISITED;
+    if (seen.holdsObjects) findSeen(object, visited.count, index);
+  }
+
+  addVisited(object);
+  return false;
+}
+
+// Containers are handled without recursion, so deep lists and chains of
+// instances need no deep C stack. Each container still being written or
+// read has a frame: the encoder counts position up through the items and
+// the decoder counts it down to zero. A decoded key waits in the frame
+// for its value; like everything decoded it is also on the root list.
+typedef struct {
+  Object* object;
+  int position;
+  bool haveKey;
+  Value key;
+} Frame;
+
+typedef struct {
+  Frame* frames;
+  int count;
+  int capacity;
+} FrameStack;
+
+static FrameStack frameStack;
+
+static void pushFrame(Object* object, int position, const char* function) {
+  if (frameStack.count == frameStack.capacity) {
+    int capacity = GROW_CAPACITY(frameStack.capacity);
+    Frame* frames = (Frame*)realloc(frameStack.frames, sizeof(Frame) * capacity);
+    if (frames == NULL) outOfMemory(function);
+
+    frameStack.frames = frames;
+    frameStack.capacity = capacity;
+  }
+
+  Frame* frame = &frameStack.frames[frameStack.count++];
+  frame->object = object;
+  frame->position = position;
+  frame->haveKey = false;
+  frame->key = NULL_VAL;
+}
+
+static inline void writeByte(OutputBuffer* output, uint8_t byte) {
+  writeOutput(output, (const char*)&byte, 1);
+}
+
+// Varints hold seven bits a byte, low bits first, with the high bit set on
+// every byte but the last. Returns the number of bytes used, at most 10.
+static inline size_t encodeVarint(char* bytes, uint64_t value) {
+  size_t length = 0;
+  while (value >= 0x80) {
+    bytes[length++] = (char)(value | 0x80);
+    value >>= 7;
+  }
+  bytes[length++] = (char)value;
+  return length;
+}
+
+static inline void writeVarint(OutputBuffer* output, uint64_t value) {
+  char* bytes = reserveOutput(output, 10);
+  if (bytes != NULL) output->count += encodeVarint(bytes, value);
+}
+
+static inline void writeTagged(OutputBuffer* output, Tag tag, uint64_t value) {
+  char* bytes = reserveOutput(output, 11);
+  if (bytes == NULL) return;
+
+  bytes[0] = (char)tag;
+  output->count += 1 + encodeVarint(bytes + 1, value);
+}
+
+static void writePiece(ObjectString* piece, void* context) {
+  writeOutput((OutputBuffer*)context, piece->chars, piece->length);
+}
+
+// Writes value. A container that has not been written before only has its
+// header written here; a frame is pushed so its contents follow.
+static void encodeValue(OutputBuffer* output, Value value) {
+  switch (value.type) {
+    case VAL_NULL:
+      writeByte(output, TAG_NULL);
+      return;
+    case VAL_BOOL:
+      writeByte(output, AS_BOOL(value) ? TAG_TRUE : TAG_FALSE);
+      return;
+    case VAL_INTEGER: {
+      uint64_t bits = (uint64_t)AS_INTEGER(value);
+      writeTagged(output, TAG_INTEGER, (bits << 1) ^ (0 - (bits >> 63)));
+      return;
+    }
+    case VAL_NUMBER: {
+      char bytes[1 + sizeof(double)] = { TAG_NUMBER };
+      memcpy(bytes + 1, &AS_NUMBER(value), sizeof(double));
+      writeOutput(output, bytes, sizeof(bytes));
+      return;
+    }
+    case VAL_OBJECT:
+      break;
+  }
+
+  Object* object = AS_OBJECT(value);
+  uint32_t index;
+  if (seenBefore(object, &index)) {
+    writeTagged(output, TAG_REFERENCE, index);
+    return;
+  }
+
+  switch (object->type) {
+    case OBJECT_STRING: {
+      ObjectString* string = (ObjectString*)object;
+      writeTagged(output, TAG_STRING, (uint64_t)string->length);
+      writeOutput(output, string->chars, string->length);
+      break;
+    }
+    case OBJECT_ROPE: {
+      ObjectRope* rope = (ObjectRope*)object;
+      writeTagged(output, TAG_STRING, (uint64_t)rope->length);
+      forEachRopePiece(rope, writePiece, output);
+      break;
+    }
+    case OBJECT_FLOAT64_ARRAY: {
+      ObjectFloat64Array* array = (ObjectFloat64Array*)object;
+      writeTagged(output, TAG_FLOAT64_ARRAY, (uint64_t)array->length);
+      if (array->length > 0) writeOutput(output, (const char*)array->values, sizeof(double) * array->length);
+      break;
+    }
+    case OBJECT_LIST: {
+      ObjectList* list = (ObjectList*)object;
+      writeTagged(output, TAG_LIST, (uint64_t)list->items.count);
+      if (list->items.count > 0) pushFrame(object, 0, "serialize");
+      break;
+    }
+    case OBJECT_MAP: {
+      ObjectMap* map = (ObjectMap*)object;
+      writeTagged(output, TAG_MAP, (uint64_t)map->map.count);
+      if (map->map.count > 0) pushFrame(object, 0, "serialize");
+      break;
+    }
+    case OBJECT_INSTANCE: {
+      ObjectInstance* instance = (ObjectInstance*)object;
+      writeByte(output, TAG_INSTANCE);
+      encodeValue(output, OBJECT_VAL(instance->_class->name));
+      writeVarint(output, (uint64_t)instance->fields.count);
+      if (instance->fields.count > 0) pushFrame(object, 0, "serialize");
+      break;
+    }
+    default:
+      endVisit();
+      throwRuntimeError("serialize() cannot encode %s values", objectTypeName(object->type));
+  }
+}
+
+// Finds the next value in the container on top of the frame stack. Map
+// and instance entries give their key and then their value.
+static bool nextEncodedValue(Frame* frame, Value* value) {
+  switch (frame->object->type) {
+    case OBJECT_LIST: {
+      ValueArray* items = &((ObjectList*)frame->object)->items;
+      if (frame->position == items->count) return false;
+
+      *value = items->values[frame->position++];
+      return true;
+    }
+    case OBJECT_MAP: {
+      Map* map = &((ObjectMap*)frame->object)->map;
+      int entry = frame->position / 2;
+      while (entry < map->entryCount && map->entries[entry].deleted) entry++;
+      if (entry == map->entryCount) return false;
+
+      bool isKey = frame->position % 2 == 0;
+      *value = isKey ? map->entries[entry].key : map->entries[entry].value;
+      frame->position = entry * 2 + 1 + !isKey;
+      return true;
+    }
+    case OBJECT_INSTANCE: {
+      Table* fields = &((ObjectInstance*)frame->object)->fields;
+      int slot = frame->position / 2;
+      while (slot < fields->capacity && fields->entries[slot].key == NULL) slot++;
+      if (slot == fields->capacity) return false;
+
+      bool isKey = frame->position % 2 == 0;
+      *value = isKey ? OBJECT_VAL(fields->entries[slot].key) : fields->entries[slot].value;
+      frame->position = slot * 2 + 1 + !isKey;
+      return true;
+    }
+    default:
+      return false;
+  }
+}
+
+static void encodeGraph(OutputBuffer* output, Value value) {
+  frameStack.count = 0;
+  encodeValue(output, value);
+
+  while (frameStack.count > 0) {
+    Value next;
+    if (!nextEncodedValue(&frameStack.frames[frameStack.count - 1], &next)) {
+      frameStack.count--;
+      continue;
+    }
+
+    encodeValue(output, next);
+  }
+}
+
+typedef struct {
+  const char* bytes;
+  size_t length;
+  size_t current;
+  ObjectString* input;
+  ObjectList* objects;
+  int objectCount;
+  ObjectString* lastClassName;
+  ObjectClass* lastClass;
+} Decoder;
+
+static _Noreturn void decodeError(Decoder* decoder, const char* message) {
+  throwRuntimeError("deserialize() %s at offset %zu", message, decoder->current);
+}
+
+static uint8_t readByte(Decoder* decoder) {
+  if (decoder->current == decoder->length) decodeError(decoder, "unexpected end of input");
+  return (uint8_t)decoder->bytes[decoder->current++];
+}
+
+static uint64_t readVarint(Decoder* decoder) {
+  uint64_t value = 0;
+
+  for (int shift = 0; shift < 64; shift += 7) {
+    uint8_t byte = readByte(decoder);
+    value |= (uint64_t)(byte & 0x7F) << shift;
+    if (byte < 0x80) return value;
+  }
+
+  decodeError(decoder, "invalid varint");
+}
+
+// Reads a count of items that each take at least itemSize bytes, so a
+// corrupt count is caught before anything is allocated for it.
+static int readCount(Decoder* decoder, size_t itemSize) {
+  uint64_t count = readVarint(decoder);
+  if (count > (decoder->length - decoder->current) / itemSize) decodeError(decoder, "count runs past the end");
+  return (int)count;
+}
+
+// Numbers the next string or object. Its slot on the root list is filled
+// once it exists; reserving it first means nothing is unrooted while the
+// object is allocated.
+static int claimSlot(Decoder* decoder) {
+  ValueArray* items = &decoder->objects->items;
+  if (items->count == decoder->objectCount) decodeError(decoder, "more objects than the header declares");
+
+  items->values[items->count] = NULL_VAL;
+  return items->count++;
+}
+
+// Instances get the program's global class of that name if there is one.
+// Classes hold nothing but a name, so for any other name a new one is made.
+static ObjectClass* resolveClass(Decoder* decoder, ObjectString* name) {
+  if (name == decoder->lastClassName) return decoder->lastClass;
+
+  Value value;
+  ObjectClass* _class;
+  if (tableGet(&vm.globals, name, &value) && IS_CLASS(value)) {
+    _class = AS_CLASS(value);
+  } else if (name == vm.jsonClass->name) {
+    _class = vm.jsonClass;
+  } else {
+    _class = newClass(name);
+  }
+
+  decoder->lastClassName = name;
+  decoder->lastClass = _class;
+  return _class;
+}
+
+// Reads one value. Field names come back interned, as table keys must be.
+// A new container is created at its full size, empty, and a frame pushed
+// to fill it. Every string and object read is kept on the root list.
+static Value decodeValue(Decoder* decoder, bool isName) {
+  size_t start = decoder->current;
+  uint8_t tag = readByte(decoder);
+  if (isName && tag != TAG_STRING && tag != TAG_REFERENCE) decodeError(decoder, "expected a string name");
+
+  ValueArray* objects = &decoder->objects->items;
+
+  switch (tag) {
+    case TAG_NULL: return NULL_VAL;
+    case TAG_FALSE: return BOOL_VAL(false);
+    case TAG_TRUE: return BOOL_VAL(true);
+    case TAG_INTEGER: {
+      uint64_t bits = readVarint(decoder);
+      return INTEGER_VAL((int64_t)((bits >> 1) ^ (0 - (bits & 1))));
+    }
+    case TAG_NUMBER: {
+      if (decoder->length - decoder->current < sizeof(double)) decodeError(decoder, "unexpected end of input");
+
+      double number;
+      memcpy(&number, decoder->bytes + decoder->current, sizeof(double));
+      decoder->current += sizeof(double);
+      return NUMBER_VAL(number);
+    }
+    case TAG_STRING: {
+      int length = readCount(decoder, 1);
+      int slot = claimSlot(decoder);
+      const char* chars = decoder->bytes + decoder->current;
+
+      ObjectString* string = isName ? copyString(chars, length)
+                                    : newStringView(decoder->input, (int)decoder->current, length);
+      objects->values[slot] = OBJECT_VAL(string);
+      decoder->current += length;
+      return OBJECT_VAL(string);
+    }
+    case TAG_LIST: {
+      int count = readCount(decoder, 1);
+      int slot = claimSlot(decoder);
+
+      ObjectList* list = newList();
+      objects->values[slot] = OBJECT_VAL(list);
+      reserveValueArray(&list->items, count);
+      if (count > 0) pushFrame((Object*)list, count, "deserialize");
+      return OBJECT_VAL(list);
+    }
+    case TAG_MAP: {
+      int count = readCount(decoder, 2);
+      int slot = claimSlot(decoder);
+
+      ObjectMap* map = newMap();
+      objects->values[slot] = OBJECT_VAL(map);
+      mapReserve(&map->map, count);
+      if (count > 0) pushFrame((Object*)map, count, "deserialize");
+      return OBJECT_VAL(map);
+    }
+    case TAG_INSTANCE: {
+      int slot = claimSlot(decoder);
+      ObjectClass* _class = resolveClass(decoder, AS_STRING(decodeValue(decoder, true)));
+      int count = readCount(decoder, 2);
+
+      push(OBJECT_VAL(_class));
+      ObjectInstance* instance = newInstance(_class);
+      objects->values[slot] = OBJECT_VAL(instance);
+      pop();
+
+      tableReserve(&instance->fields, count);
+      if (count > 0) pushFrame((Object*)instance, count, "deserialize");
+      return OBJECT_VAL(instance);
+    }
+    case TAG_FLOAT64_ARRAY: {
+      int count = readCount(decoder, sizeof(double));
+      int slot = claimSlot(decoder);
+
+      ObjectFloat64Array* array = newFloat64Array(count);
+      if (count > 0) memcpy(array->values, decoder->bytes + decoder->current, sizeof(double) * count);
+      objects->values[slot] = OBJECT_VAL(array);
+      decoder->current += sizeof(double) * count;
+      return OBJECT_VAL(array);
+    }
+    case TAG_REFERENCE: {
+      uint64_t index = readVarint(decoder);
+      if (index >= (uint64_t)objects->count) {
+        decoder->current = start;
+        decodeError(decoder, "invalid reference");
+      }
+
+      Value value = objects->values[index];
+      if (isName) {
+        if (!IS_STRING(value)) {
+          decoder->current = start;
+          decodeError(decoder, "expected a string name");
+        }
+
+        // Later references to the same string then find it interned.
+        value = OBJECT_VAL(internString(AS_STRING(value)));
+        objects->values[index] = value;
+      }
+
+      return value;
+    }
+    default:
+      decoder->current = start;
+      decodeError(decoder, "unknown tag");
+  }
+}
+
+// Stores value as the next item of the container on top of the frame
+// stack. Containers were sized when they were created, so nothing here
+// allocates.
+static void storeDecodedValue(Frame* frame, Value value) {
+  switch (frame->object->type) {
+    case OBJECT_LIST: {
+      ValueArray* items = &((ObjectList*)frame->object)->items;
+      items->values[items->count++] = value;
+      frame->position--;
+      return;
+    }
+    case OBJECT_MAP:
+      if (!frame->haveKey) {
+        frame->key = value;
+        frame->haveKey = true;
+        return;
+      }
+
+      mapSet(&((ObjectMap*)frame->object)->map, frame->key, value);
+      break;
+    case OBJECT_INSTANCE:
+      if (!frame->haveKey) {
+        frame->key = value;
+        frame->haveKey = true;
+        return;
+      }
+
+      tableSet(&((ObjectInstance*)frame->object)->fields, AS_STRING(frame->key), value);
+      break;
+    default:
+      return;
+  }
+
+  frame->haveKey = false;
+  frame->position--;
+}
+
+// Decodes the whole graph in one pass over the input.
+static Value decodeGraph(Decoder* decoder) {
+  frameStack.count = 0;
+  Value result = decodeValue(decoder, false);
+
+  while (frameStack.count > 0) {
+    int top = frameStack.count - 1;
+    Frame* frame = &frameStack.frames[top];
+
+    if (frame->position == 0) {
+      frameStack.count--;
+      continue;
+    }
+
+    bool isName = frame->object->type == OBJECT_INSTANCE && !frame->haveKey;
+    Value value = decodeValue(decoder, isName);
+    storeDecodedValue(&frameStack.frames[top], value);
+  }
+
+  return result;
+}
+
+static void checkArity(int argCount, int arity, const char* function) {
+  if (argCount != arity) {
+    throwRuntimeError("%s() expects %d arguments but got %d", function, arity, argCount);
+  }
+}
+
+// serialize(value) returns value encoded as a compact binary string, see
+// the format above. Numbers, bools, null, strings, lists, maps, instances
+// and Float64Arrays can be encoded.
+Value serializeNative(int argCount, Value* args) {
+  checkArity(argCount, 1, "serialize");
+
+  OutputBuffer* output = scratchBuffer();
+  writeOutput(output, serialMagic, sizeof(serialMagic));
+  writeOutput(output, "\0\0\0\0", 4);
+
+  beginVisit();
+  encodeGraph(output, args[0]);
+  uint32_t objectCount = visited.count;
+  endVisit();
+
+  if (output->failed) throwRuntimeError("Not enough memory to serialize value");
+  if (output->count > INT_MAX - 1) throwRuntimeError("serialize() result is too large");
+  memcpy(output->bytes + sizeof(serialMagic), &objectCount, sizeof(objectCount));
+
+  ObjectString* result = allocateString((int)output->count);
+  memcpy(result->chars, output->bytes, output->count);
+  if (output->capacity > SCRATCH_KEEP_SIZE) setOutputSize(output, 0);
+  return OBJECT_VAL(result);
+}
+
+// deserialize(bytes) rebuilds the value serialize() encoded in bytes.
+// Strings come back as views of bytes where that saves a copy.
+Value deserializeNative(int argCount, Value* args) {
+  checkArity(argCount, 1, "deserialize");
+  if (IS_ROPE(args[0])) args[0] = OBJECT_VAL(flattenRope(AS_ROPE(args[0])));
+  if (!IS_STRING(args[0])) throwRuntimeError("deserialize() expects a string");
+
+  ObjectString* input = AS_STRING(args[0]);
+  if (input->length < HEADER_SIZE || memcmp(input->chars, serialMagic, sizeof(serialMagic)) != 0) {
+    throwRuntimeError("deserialize() input was not made by serialize()");
+  }
+
+  uint32_t objectCount;
+  memcpy(&objectCount, input->chars + sizeof(serialMagic), sizeof(objectCount));
+
+  Decoder decoder;
+  decoder.bytes = input->chars;
+  decoder.length = input->length;
+  decoder.current = HEADER_SIZE;
+  decoder.input = input;
+  decoder.lastClassName = NULL;
+  decoder.lastClass = NULL;
+
+  // Every string or object takes at least two bytes.
+  if (objectCount > (decoder.length - HEADER_SIZE) / 2) decodeError(&decoder, "object count is too large");
+  decoder.objectCount = (int)objectCount;
+
+  decoder.objects = newList();
+  push(OBJECT_VAL(decoder.objects));
+  reserveValueArray(&decoder.objects->items, decoder.objectCount);
+
+  Value result = decodeGraph(&decoder);
+  if (decoder.current != decoder.length) decodeError(&decoder, "unexpected trailing bytes");
+
+  pop();
+  return result;
+}
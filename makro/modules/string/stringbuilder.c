@@ -0,0 +1,91 @@
+#include <string.h>
+
+#include "../../include/memory.h"
+#include "../../include/number.h"
+#include "../../include/stringbuilder.h"
+#include "../../include/vm.h"
+
+// toString() keeps its scratch buffer between calls unless it grew past this.
+#define SCRATCH_KEEP_SIZE (1024 * 1024)
+
+static void checkArity(int argCount, int arity, const char* function) {
+  if (argCount != arity) {
+    throwRuntimeError("%s() expects %d arguments but got %d", function, arity, argCount);
+  }
+}
+
+static ObjectStringBuilder* builderArgument(Value value, const char* function) {
+  if (!IS_STRING_BUILDER(value)) throwRuntimeError("%s() expects a string builder", function);
+  return AS_STRING_BUILDER(value);
+}
+
+// Doubles the buffer as needed, so a run of appends costs amortized linear
+// time. The builder must be reachable, since growing it may collect.
+void builderAppend(ObjectStringBuilder* builder, const char* chars, int length) {
+  if (length > INT32_MAX - builder->length) throwRuntimeError("String builder is too long");
+
+  int needed = builder->length + length;
+  if (needed > builder->capacity) {
+    int capacity = GROW_CAPACITY(builder->capacity);
+    while (capacity < needed) capacity = capacity > INT32_MAX / 2 ? INT32_MAX : capacity * 2;
+
+    builder->chars = GROW_ARRAY(char, builder->chars, builder->capacity, capacity);
+    builder->capacity = capacity;
+  }
+
+  memcpy(builder->chars + builder->length, chars, length);
+  builder->length = needed;
+}
+
+// StringBuilder() returns a new, empty builder. Text is added with
+// append() and appendNumber(), and length() reports its current size.
+Value stringBuilderNative(int argCount, Value* args) {
+  (void)args;
+  checkArity(argCount, 0, "StringBuilder");
+
+  return OBJECT_VAL(newStringBuilder());
+}
+
+// appendNumber(builder, number) appends number as print would show it and
+// returns the builder.
+Value appendNumberNative(int argCount, Value* args) {
+  checkArity(argCount, 2, "appendNumber");
+  ObjectStringBuilder* builder = builderArgument(args[0], "appendNumber");
+  if (!IS_NUMERIC(args[1])) throwRuntimeError("appendNumber() expects a number");
+
+  char buffer[NUMBER_BUFFER_SIZE];
+  int length = IS_INTEGER(args[1]) ? formatInteger(AS_INTEGER(args[1]), buffer) : formatNumber(AS_NUMBER(args[1]), buffer);
+  builderAppend(builder, buffer, length);
+  return args[0];
+}
+
+// toString(value) returns value as print would show it. For a builder that
+// is the text built so far, as a single interned string; the builder keeps
+// its contents and can be appended to further.
+Value toStringNative(int argCount, Value* args) {
+  checkArity(argCount, 1, "toString");
+  if (IS_STRING_LIKE(args[0])) return args[0];
+
+  if (IS_STRING_BUILDER(args[0])) {
+    ObjectStringBuilder* builder = AS_STRING_BUILDER(args[0]);
+    if (builder->length == 0) return OBJECT_VAL(copyString("", 0));
+    return OBJECT_VAL(copyString(builder->chars, builder->length));
+  }
+
+  // Anything else is written to a buffer outside the heap that is reused,
+  // so running into the heap limit while copying it out leaks nothing.
+  static OutputBuffer scratch;
+  static bool initialized = false;
+  if (!initialized) {
+    initOutput(&scratch, OUTPUT_MEMORY, 0);
+    initialized = true;
+  }
+
+  flushOutput(&scratch);
+  writeValue(&scratch, args[0]);
+  if (scratch.count > INT32_MAX) throwRuntimeError("toString() result is too long");
+
+  ObjectString* string = copyString(scratch.count > 0 ? scratch.bytes : "", (int)scratch.count);
+  if (scratch.capacity > SCRATCH_KEEP_SIZE) setOutputSize(&scratch, 0);
+  return OBJECT_VAL(string);
+}
@@ -0,0 +1,287 @@
+#include <string.h>
+
+#include "../../include/memory.h"
+#include "../../include/number.h"
+#include "../../include/object.h"
+#include "../../include/stringlib.h"
+#include "../../include/vm.h"
+
+// Substring search compares a whole block of candidate start positions at
+// once against the first and last byte of the needle, and only runs memcmp
+// where both match. The lanes are 32 bytes wide with AVX2 and 16 with SSE2;
+// elsewhere the scalar memchr loop does all the work.
+#if defined(__AVX2__)
+#include <immintrin.h>
+
+typedef __m256i Bytes;
+#define BYTE_LANES 32
+#define bytesLoad(pointer) _mm256_loadu_si256((const __m256i*)(pointer))
+#define bytesSplat(byte) _mm256_set1_epi8(byte)
+#define bytesMatchBoth(a, first, b, last) \
+  ((uint32_t)_mm256_movemask_epi8(_mm256_and_si256(_mm256_cmpeq_epi8(a, first), _mm256_cmpeq_epi8(b, last))))
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+
+typedef __m128i Bytes;
+#define BYTE_LANES 16
+#define bytesLoad(pointer) _mm_loadu_si128((const __m128i*)(pointer))
+#define bytesSplat(byte) _mm_set1_epi8(byte)
+#define bytesMatchBoth(a, first, b, last) \
+  ((uint32_t)_mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(a, first), _mm_cmpeq_epi8(b, last))))
+#endif
+
+// Returns the offset of the first occurrence of needle in haystack, or -1.
+static int findSubstring(const char* haystack, int length, const char* needle, int needleLength) {
+  if (needleLength == 0) return 0;
+  if (needleLength > length) return -1;
+
+  if (needleLength == 1) {
+    const char* found = (const char*)memchr(haystack, needle[0], length);
+    return found == NULL ? -1 : (int)(found - haystack);
+  }
+
+  int lastStart = length - needleLength;
+  int i = 0;
+
+#ifdef BYTE_LANES
+  Bytes first = bytesSplat(needle[0]);
+  Bytes last = bytesSplat(needle[needleLength - 1]);
+
+  for (; i + BYTE_LANES - 1 <= lastStart; i += BYTE_LANES) {
+    Bytes starts = bytesLoad(haystack + i);
+    Bytes ends = bytesLoad(haystack + i + needleLength - 1);
+
+    for (uint32_t match = bytesMatchBoth(starts, first, ends, last); match != 0; match &= match - 1) {
+      int start = i + __builtin_ctz(match);
+      if (memcmp(haystack + start + 1, needle + 1, needleLength - 2) == 0) return start;
+    }
+  }
+#endif
+
+  while (i <= lastStart) {
+    const char* found = (const char*)memchr(haystack + i, needle[0], lastStart - i + 1);
+    if (found == NULL) return -1;
+
+    i = (int)(found - haystack);
+    if (memcmp(found + 1, needle + 1, needleLength - 1) == 0) return i;
+    i++;
+  }
+
+  return -1;
+}
+
+static bool isSpace(char c) {
+  return c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '\v' || c == '\f';
+}
+
+static void checkArity(int argCount, int arity, const char* function) {
+  if (argCount != arity) {
+    throwRuntimeError("%s() expects %d arguments but got %d", function, arity, argCount);
+  }
+}
+
+// Ropes are flattened in their argument slot, which keeps the flat string
+// rooted for the rest of the call.
+static ObjectString* stringArgument(Value* slot, const char* function) {
+  if (IS_ROPE(*slot)) *slot = OBJECT_VAL(flattenRope(AS_ROPE(*slot)));
+  if (!IS_STRING(*slot)) throwRuntimeError("%s() expects a string", function);
+  return AS_STRING(*slot);
+}
+
+// Accepts an integer position in [0, length].
+static int positionArgument(Value value, int length, const char* function) {
+  if (!IS_NUMERIC(value)) throwRuntimeError("%s() expects numeric positions", function);
+
+  double number = AS_NUMERIC(value);
+  if (!(number >= 0 && number <= length) || (int)number != number) {
+    throwRuntimeError("%s() position out of range", function);
+  }
+
+  return (int)number;
+}
+
+// Appends a string to list, keeping it on the stack while the list grows.
+static void appendString(ObjectList* list, ObjectString* string) {
+  push(OBJECT_VAL(string));
+  writeValueArray(&list->items, OBJECT_VAL(string));
+  pop();
+}
+
+// indexOf(string, needle) returns the position of the first occurrence of
+// needle, or -1.
+Value indexOfNative(int argCount, Value* args) {
+  checkArity(argCount, 2, "indexOf");
+  ObjectString* string = stringArgument(&args[0], "indexOf");
+  ObjectString* needle = stringArgument(&args[1], "indexOf");
+
+  return INTEGER_VAL(findSubstring(string->chars, string->length, needle->chars, needle->length));
+}
+
+Value containsNative(int argCount, Value* args) {
+  checkArity(argCount, 2, "contains");
+  ObjectString* string = stringArgument(&args[0], "contains");
+  ObjectString* needle = stringArgument(&args[1], "contains");
+
+  return BOOL_VAL(findSubstring(string->chars, string->length, needle->chars, needle->length) >= 0);
+}
+
+Value startsWithNative(int argCount, Value* args) {
+  checkArity(argCount, 2, "startsWith");
+  ObjectString* string = stringArgument(&args[0], "startsWith");
+  ObjectString* prefix = stringArgument(&args[1], "startsWith");
+
+  return BOOL_VAL(prefix->length <= string->length && memcmp(string->chars, prefix->chars, prefix->length) == 0);
+}
+
+Value endsWithNative(int argCount, Value* args) {
+  checkArity(argCount, 2, "endsWith");
+  ObjectString* string = stringArgument(&args[0], "endsWith");
+  ObjectString* suffix = stringArgument(&args[1], "endsWith");
+
+  int start = string->length - suffix->length;
+  return BOOL_VAL(start >= 0 && memcmp(string->chars + start, suffix->chars, suffix->length) == 0);
+}
+
+// substring(string, start, end) returns the characters in [start, end)
+// without copying them.
+Value substringNative(int argCount, Value* args) {
+  checkArity(argCount, 3, "substring");
+  ObjectString* string = stringArgument(&args[0], "substring");
+
+  int start = positionArgument(args[1], string->length, "substring");
+  int end = positionArgument(args[2], string->length, "substring");
+  if (start > end) throwRuntimeError("substring() start is past its end");
+
+  return OBJECT_VAL(newStringView(string, start, end - start));
+}
+
+// trim(string) returns string without leading and trailing whitespace.
+Value trimNative(int argCount, Value* args) {
+  checkArity(argCount, 1, "trim");
+  ObjectString* string = stringArgument(&args[0], "trim");
+
+  int start = 0;
+  int end = string->length;
+  while (start < end && isSpace(string->chars[start])) start++;
+  while (end > start && isSpace(string->chars[end - 1])) end--;
+
+  return OBJECT_VAL(newStringView(string, start, end - start));
+}
+
+// split(string, separator) returns a list of the pieces between
+// occurrences of separator.
+Value splitNative(int argCount, Value* args) {
+  checkArity(argCount, 2, "split");
+  ObjectString* string = stringArgument(&args[0], "split");
+  ObjectString* separator = stringArgument(&args[1], "split");
+  if (separator->length == 0) throwRuntimeError("split() separator must not be empty");
+
+  ObjectList* list = newList();
+  push(OBJECT_VAL(list));
+
+  int start = 0;
+  for (;;) {
+    int found = findSubstring(string->chars + start, string->length - start, separator->chars, separator->length);
+    if (found < 0) break;
+
+    appendString(list, newStringView(string, start, found));
+    start += found + separator->length;
+  }
+
+  appendString(list, newStringView(string, start, string->length - start));
+
+  pop();
+  return OBJECT_VAL(list);
+}
+
+// join(list, separator) returns the strings in list with separator between
+// each pair, built with a single allocation.
+Value joinNative(int argCount, Value* args) {
+  checkArity(argCount, 2, "join");
+  if (!IS_LIST(args[0])) throwRuntimeError("join() expects a list");
+  ObjectList* list = AS_LIST(args[0]);
+  ObjectString* separator = stringArgument(&args[1], "join");
+
+  int64_t length = 0;
+  for (int i = 0; i < list->items.count; i++) {
+    Value item = list->items.values[i];
+    if (IS_ROPE(item)) item = OBJECT_VAL(flattenRope(AS_ROPE(item)));
+    if (!IS_STRING(item)) throwRuntimeError("join() items must be strings");
+
+    length += AS_STRING(item)->length;
+    if (i > 0) length += separator->length;
+  }
+
+  if (length > INT32_MAX - 1) throwRuntimeError("join() result is too long");
+
+  ObjectString* result = allocateString((int)length);
+  char* dest = result->chars;
+
+  // Flattened ropes cache their result, so the second pass cannot allocate.
+  for (int i = 0; i < list->items.count; i++) {
+    Value item = list->items.values[i];
+    ObjectString* piece = IS_ROPE(item) ? AS_ROPE(item)->flat : AS_STRING(item);
+
+    if (i > 0) {
+      memcpy(dest, separator->chars, separator->length);
+      dest += separator->length;
+    }
+
+    memcpy(dest, piece->chars, piece->length);
+    dest += piece->length;
+  }
+
+  return OBJECT_VAL(result);
+}
+
+// replace(string, from, to) returns string with every occurrence of from
+// replaced by to.
+Value replaceNative(int argCount, Value* args) {
+  checkArity(argCount, 3, "replace");
+  ObjectString* string = stringArgument(&args[0], "replace");
+  ObjectString* from = stringArgument(&args[1], "replace");
+  ObjectString* to = stringArgument(&args[2], "replace");
+  if (from->length == 0) throwRuntimeError("replace() pattern must not be empty");
+
+  int count = 0;
+  for (int start = 0;;) {
+    int found = findSubstring(string->chars + start, string->length - start, from->chars, from->length);
+    if (found < 0) break;
+
+    count++;
+    start += found + from->length;
+  }
+
+  if (count == 0) return args[0];
+
+  int64_t length = string->length + (int64_t)count * (to->length - from->length);
+  if (length > INT32_MAX - 1) throwRuntimeError("replace() result is too long");
+
+  ObjectString* result = allocateString((int)length);
+  char* dest = result->chars;
+
+  int start = 0;
+  for (int i = 0; i < count; i++) {
+    int found = findSubstring(string->chars + start, string->length - start, from->chars, from->length);
+
+    memcpy(dest, string->chars + start, found);
+    dest += found;
+    memcpy(dest, to->chars, to->length);
+    dest += to->length;
+    start += found + from->length;
+  }
+
+  memcpy(dest, string->chars + start, string->length - start);
+  return OBJECT_VAL(result);
+}
+
+// toFixed(number, digits) returns number rounded to digits decimals.
+Value toFixedNative(int argCount, Value* args) {
+  checkArity(argCount, 2, "toFixed");
+  if (!IS_NUMERIC(args[0])) throwRuntimeError("toFixed() expects a number");
+  int digits = positionArgument(args[1], FIXED_MAX_DIGITS, "toFixed");
+
+  char buffer[NUMBER_BUFFER_SIZE];
+  int length = formatFixed(AS_NUMERIC(args[0]), digits, buffer);
+  return OBJECT_VAL(copyString(buffer, length));
+}
@@ -0,0 +1,108 @@
+#include <string.h>
+
+#include "../include/heap.h"
+#include "../include/intern.h"
+#include "../include/memory.h"
+
+#define INTERN_MAX_LOAD 0.75
+
+void initInternSet(InternSet* set) {
+  set->count = 0;
+  set->capacity = 0;
+  set->entries = NULL;
+}
+
+void freeInternSet(InternSet* set) {
+  FREE_ARRAY(InternEntry, set->entries, set->capacity);
+  initInternSet(set);
+}
+
+ObjectString* internSetFind(InternSet* set, const char* chars, int length, uint32_t hash) {
+  if (set->count == 0) return NULL;
+
+  uint32_t mask = set->capacity - 1;
+  for (uint32_t index = hash & mask;; index = (index + 1) & mask) {
+    InternEntry* entry = &set->entries[index];
+    if (entry->string == NULL) return NULL;
+
+    if (entry->hash == hash && entry->length == length && memcmp(entry->string->chars, chars, length) == 0) {
+      return entry->string;
+    }
+  }
+}
+
+static void insertEntry(InternEntry* entries, int capacity, InternEntry entry) {
+  uint32_t mask = capacity - 1;
+  uint32_t index = entry.hash & mask;
+  while (entries[index].string != NULL) index = (index + 1) & mask;
+
+  entries[index] = entry;
+}
+
+static void adjustCapacity(InternSet* set, int capacity) {
+  InternEntry* entries = ALLOCATE(InternEntry, capacity);
+  memset(entries, 0, sizeof(InternEntry) * capacity);
+
+  for (int i = 0; i < set->capacity; i++) {
+    if (set->entries[i].string != NULL) insertEntry(entries, capacity, set->entries[i]);
+  }
+
+  FREE_ARRAY(InternEntry, set->entries, set->capacity);
+  set->entries = entries;
+  set->capacity = capacity;
+}
+
+// The caller has already checked that no equal string is interned.
+void internSetAdd(InternSet* set, ObjectString* string) {
+  if (set->count + 1 > set->capacity * INTERN_MAX_LOAD) {
+    adjustCapacity(set, GROW_CAPACITY(set->capacity));
+  }
+
+  InternEntry entry = { string->hash, string->length, string };
+  insertEntry(set->entries, set->capacity, entry);
+  set->count++;
+}
+
+static inline bool isHome(uint32_t home, uint32_t hole, uint32_t index, uint32_t mask) {
+  return ((index - home) & mask) < ((index - hole) & mask);
+}
+
+// Drops every unmarked string. Deletion shifts the rest of the probe run
+// back into the hole, so the set never holds tombstones. The walk starts
+// just past an empty slot so that no run wraps around under it.
+void internSetSweep(InternSet* set) {
+  if (set->count == 0) return;
+
+  uint32_t mask = set->capacity - 1;
+  uint32_t start = 0;
+  while (set->entries[start].string != NULL) start++;
+
+  for (uint32_t step = 1; step <= mask; step++) {
+    uint32_t hole = (start + step) & mask;
+    InternEntry* entry = &set->entries[hole];
+    if (entry->string == NULL || isObjectMarked((Object*)entry->string)) continue;
+
+    set->count--;
+
+    uint32_t index = hole;
+    for (;;) {
+      index = (index + 1) & mask;
+      InternEntry* next = &set->entries[index];
+      if (next->string == NULL) break;
+      if (isHome(next->hash & mask, hole, index, mask)) continue;
+
+      set->entries[hole] = *next;
+      hole = index;
+    }
+
+    set->entries[hole].string = NULL;
+    step--;
+  }
+}
+
+void forwardInternSet(InternSet* set) {
+  for (int i = 0; i < set->capacity; i++) {
+    InternEntry* entry = &set->entries[i];
+    entry->string = (ObjectString*)forwardObject((Object*)entry->string);
+  }
+}
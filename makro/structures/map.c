@@ -0,0 +1,220 @@
+#include <setjmp.h>
+#include <string.h>
+
+#include "../include/heap.h"
+#include "../include/map.h"
+#include "../include/memory.h"
+#include "../include/object.h"
+#include "../include/vm.h"
+
+#define MAP_MIN_CAPACITY 8
+#define INDEX_EMPTY -1
+#define INDEX_DELETED -2
+
+#define INDEX_CAPACITY(map) ((map)->entryCapacity * 2)
+
+void initMap(Map* map) {
+  map->count = 0;
+  map->entryCount = 0;
+  map->entryCapacity = 0;
+  map->entries = NULL;
+  map->index = NULL;
+}
+
+void freeMap(Map* map) {
+  FREE_ARRAY(MapEntry, map->entries, map->entryCapacity);
+  FREE_ARRAY(int32_t, map->index, INDEX_CAPACITY(map));
+  initMap(map);
+}
+
+static uint32_t hashBits(uint64_t bits) {
+  bits ^= bits >> 33;
+  bits *= 0xff51afd7ed558ccdull;
+  bits ^= bits >> 33;
+  bits *= 0xc4ceb9fe1a85ec53ull;
+  bits ^= bits >> 33;
+  return (uint32_t)bits;
+}
+
+// Consistent with valuesEqual(): strings hash by content, so callers must
+// flatten ropes first, doubles holding an integral value hash like the
+// equal integer, and other objects hash by identity.
+uint32_t hashValue(Value value) {
+  switch (value.type) {
+    case VAL_BOOL: return AS_BOOL(value) ? 1231 : 1237;
+    case VAL_INTEGER: return hashBits((uint64_t)AS_INTEGER(value));
+    case VAL_NULL: return 0;
+    case VAL_NUMBER: {
+      int64_t integer;
+      if (integerFromNumber(AS_NUMBER(value), &integer)) return hashBits((uint64_t)integer);
+
+      double number = AS_NUMBER(value);
+      uint64_t bits;
+      memcpy(&bits, &number, sizeof(bits));
+      return hashBits(bits);
+    }
+    case VAL_OBJECT:
+      if (IS_STRING(value)) return stringHash(AS_STRING(value));
+      return hashBits((uintptr_t)AS_OBJECT(value));
+  }
+
+  return 0;
+}
+
+// Returns the index slot that refers to key, or -1 if it is absent.
+static int findSlot(Map* map, Value key, uint32_t hash) {
+  if (map->count == 0) return -1;
+
+  uint32_t mask = INDEX_CAPACITY(map) - 1;
+  for (uint32_t slot = hash & mask;; slot = (slot + 1) & mask) {
+    int32_t position = map->index[slot];
+    if (position == INDEX_EMPTY) return -1;
+    if (position == INDEX_DELETED) continue;
+
+    MapEntry* entry = &map->entries[position];
+    if (entry->hash == hash && valuesEqual(entry->key, key)) return (int)slot;
+  }
+}
+
+static void insertIndex(int32_t* index, int capacity, uint32_t hash, int32_t position) {
+  uint32_t mask = capacity - 1;
+  uint32_t slot = hash & mask;
+  while (index[slot] >= 0) slot = (slot + 1) & mask;
+
+  index[slot] = position;
+}
+
+static void rebuildIndex(Map* map) {
+  int capacity = INDEX_CAPACITY(map);
+  for (int i = 0; i < capacity; i++) map->index[i] = INDEX_EMPTY;
+
+  for (int i = 0; i < map->entryCount; i++) {
+    MapEntry* entry = &map->entries[i];
+    if (!entry->deleted) insertIndex(map->index, capacity, entry->hash, i);
+  }
+}
+
+// Squeezes deleted entries out, keeping insertion order, and moves the
+// arrays to capacity entries.
+static void resizeMap(Map* map, int capacity) {
+  if (capacity != map->entryCapacity) {
+    // Both buffers are obtained before either is committed. If growing the
+    // entries runs out of memory, the new index is freed before the error
+    // unwinds any further, so the map and the heap count are as they were.
+    int32_t* index = ALLOCATE(int32_t, capacity * 2);
+
+    jmp_buf handler;
+    jmp_buf* outer = vm.errorHandler;
+    if (setjmp(handler) != 0) {
+      FREE_ARRAY(int32_t, index, capacity * 2);
+      rethrowRuntimeError(outer);
+    }
+
+    vm.errorHandler = &handler;
+    MapEntry* entries = GROW_ARRAY(MapEntry, map->entries, map->entryCapacity, capacity);
+    vm.errorHandler = outer;
+
+    FREE_ARRAY(int32_t, map->index, INDEX_CAPACITY(map));
+    map->index = index;
+    map->entries = entries;
+    map->entryCapacity = capacity;
+  }
+
+  int live = 0;
+  for (int i = 0; i < map->entryCount; i++) {
+    if (!map->entries[i].deleted) map->entries[live++] = map->entries[i];
+  }
+
+  map->entryCount = live;
+  rebuildIndex(map);
+}
+
+// Grows the arrays if the live entries would still fill more than half of
+// them.
+static void adjustCapacity(Map* map) {
+  int capacity = map->entryCapacity < MAP_MIN_CAPACITY ? MAP_MIN_CAPACITY : map->entryCapacity;
+  if (map->count * 2 >= capacity) capacity *= 2;
+  resizeMap(map, capacity);
+}
+
+// Makes room for count more entries, so adding them never resizes the map.
+void mapReserve(Map* map, int count) {
+  if (map->entryCount + count <= map->entryCapacity) return;
+
+  int capacity = map->entryCapacity < MAP_MIN_CAPACITY ? MAP_MIN_CAPACITY : map->entryCapacity;
+  while (capacity < map->count + count) capacity *= 2;
+  resizeMap(map, capacity);
+}
+
+bool mapGet(Map* map, Value key, Value* value) {
+  int slot = findSlot(map, key, hashValue(key));
+  if (slot < 0) return false;
+
+  *value = map->entries[map->index[slot]].value;
+  return true;
+}
+
+// Returns true if key was not in the map before.
+bool mapSet(Map* map, Value key, Value value) {
+  uint32_t hash = hashValue(key);
+  int slot = findSlot(map, key, hash);
+  if (slot >= 0) {
+    map->entries[map->index[slot]].value = value;
+    return false;
+  }
+
+  if (map->entryCount == map->entryCapacity) adjustCapacity(map);
+
+  MapEntry* entry = &map->entries[map->entryCount];
+  entry->key = key;
+  entry->value = value;
+  entry->hash = hash;
+  entry->deleted = false;
+
+  insertIndex(map->index, INDEX_CAPACITY(map), hash, map->entryCount);
+  map->entryCount++;
+  map->count++;
+  return true;
+}
+
+bool mapDelete(Map* map, Value key) {
+  int slot = findSlot(map, key, hashValue(key));
+  if (slot < 0) return false;
+
+  MapEntry* entry = &map->entries[map->index[slot]];
+  entry->key = NULL_VAL;
+  entry->value = NULL_VAL;
+  entry->deleted = true;
+
+  map->index[slot] = INDEX_DELETED;
+  map->count--;
+  return true;
+}
+
+void markMap(Map* map) {
+  for (int i = 0; i < map->entryCount; i++) {
+    markValue(map->entries[i].key);
+    markValue(map->entries[i].value);
+  }
+}
+
+// Object keys hash by address, so if compaction moved any of them the
+// index is rebuilt in place. Nothing is allocated.
+void forwardMap(Map* map) {
+  bool moved = false;
+
+  for (int i = 0; i < map->entryCount; i++) {
+    MapEntry* entry = &map->entries[i];
+    Value key = entry->key;
+
+    forwardValue(&entry->key);
+    forwardValue(&entry->value);
+
+    if (IS_OBJECT(key) && !IS_STRING(entry->key) && AS_OBJECT(key) != AS_OBJECT(entry->key)) {
+      entry->hash = hashValue(entry->key);
+      moved = true;
+    }
+  }
+
+  if (moved) rebuildIndex(map);
+}
@@ -0,0 +1,440 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../include/number.h"
+
+// Doubles are formatted with Grisu2: the value and the boundaries of its
+// rounding interval are scaled by a cached power of ten into 64-bit
+// fixed point, and digits are generated until the result is inside the
+// interval. The output always reads back as the same double and is the
+// shortest such string in all but a tiny fraction of cases.
+
+typedef struct {
+  uint64_t f;
+  int e;
+} DiyFp;
+
+#define DOUBLE_HIDDEN_BIT 0x0010000000000000ull
+#define DOUBLE_SIGNIFICAND_MASK 0x000FFFFFFFFFFFFFull
+#define DOUBLE_EXPONENT_BIAS 1075
+
+// Normalized 64-bit approximations of 10^k for k = -348, -340, ..., 340.
+static const DiyFp cachedPowers[] = {
+  {0xfa8fd5a0081c0288ull, -1220}, {0xbaaee17fa23ebf76ull, -1193}, {0x8b16fb203055ac76ull, -1166},
+  {0xcf42894a5dce35eaull, -1140}, {0x9a6bb0aa55653b2dull, -1113}, {0xe61acf033d1a45dfull, -1087},
+  {0xab70fe17c79ac6caull, -1060}, {0xff77b1fcbebcdc4full, -1034}, {0xbe5691ef416bd60cull, -1007},
+  {0x8dd01fad907ffc3cull, -980}, {0xd3515c2831559a83ull, -954}, {0x9d71ac8fada6c9b5ull, -927},
+  {0xea9c227723ee8bcbull, -901}, {0xaecc49914078536dull, -874}, {0x823c12795db6ce57ull, -847},
+  {0xc21094364dfb5637ull, -821}, {0x9096ea6f3848984full, -794}, {0xd77485cb25823ac7ull, -768},
+  {0xa086cfcd97bf97f4ull, -741}, {0xef340a98172aace5ull, -715}, {0xb23867fb2a35b28eull, -688},
+  {0x84c8d4dfd2c63f3bull, -661}, {0xc5dd44271ad3cdbaull, -635}, {0x936b9fcebb25c996ull, -608},
+  {0xdbac6c247d62a584ull, -582}, {0xa3ab66580d5fdaf6ull, -555}, {0xf3e2f893dec3f126ull, -529},
+  {0xb5b5ada8aaff80b8ull, -502}, {0x87625f056c7c4a8bull, -475}, {0xc9bcff6034c13053ull, -449},
+  {0x964e858c91ba2655ull, -422}, {0xdff9772470297ebdull, -396}, {0xa6dfbd9fb8e5b88full, -369},
+  {0xf8a95fcf88747d94ull, -343}, {0xb94470938fa89bcfull, -316}, {0x8a08f0f8bf0f156bull, -289},
+  {0xcdb02555653131b6ull, -263}, {0x993fe2c6d07b7facull, -236}, {0xe45c10c42a2b3b06ull, -210},
+  {0xaa242499697392d3ull, -183}, {0xfd87b5f28300ca0eull, -157}, {0xbce5086492111aebull, -130},
+  {0x8cbccc096f5088ccull, -103}, {0xd1b71758e219652cull, -77}, {0x9c40000000000000ull, -50},
+  {0xe8d4a51000000000ull, -24}, {0xad78ebc5ac620000ull, 3}, {0x813f3978f8940984ull, 30},
+  {0xc097ce7bc90715b3ull, 56}, {0x8f7e32ce7bea5c70ull, 83}, {0xd5d238a4abe98068ull, 109},
+  {0x9f4f2726179a2245ull, 136}, {0xed63a231d4c4fb27ull, 162}, {0xb0de65388cc8ada8ull, 189},
+  {0x83c7088e1aab65dbull, 216}, {0xc45d1df942711d9aull, 242}, {0x924d692ca61be758ull, 269},
+  {0xda01ee641a708deaull, 295}, {0xa26da3999aef774aull, 322}, {0xf209787bb47d6b85ull, 348},
+  {0xb454e4a179dd1877ull, 375}, {0x865b86925b9bc5c2ull, 402}, {0xc83553c5c8965d3dull, 428},
+  {0x952ab45cfa97a0b3ull, 455}, {0xde469fbd99a05fe3ull, 481}, {0xa59bc234db398c25ull, 508},
+  {0xf6c69a72a3989f5cull, 534}, {0xb7dcbf5354e9beceull, 561}, {0x88fcf317f22241e2ull, 588},
+  {0xcc20ce9bd35c78a5ull, 614}, {0x98165af37b2153dfull, 641}, {0xe2a0b5dc971f303aull, 667},
+  {0xa8d9d1535ce3b396ull, 694}, {0xfb9b7cd9a4a7443cull, 720}, {0xbb764c4ca7a44410ull, 747},
+  {0x8bab8eefb6409c1aull, 774}, {0xd01fef10a657842cull, 800}, {0x9b10a4e5e9913129ull, 827},
+  {0xe7109bfba19c0c9dull, 853}, {0xac2820d9623bf429ull, 880}, {0x80444b5e7aa7cf85ull, 907},
+  {0xbf21e44003acdd2dull, 933}, {0x8e679c2f5e44ff8full, 960}, {0xd433179d9c8cb841ull, 986},
+  {0x9e19db92b4e31ba9ull, 1013}, {0xeb96bf6ebadf77d9ull, 1039}, {0xaf87023b9bf0ee6bull, 1066},
+};
+
+#define CACHED_POWER_MIN_EXPONENT -348
+#define CACHED_POWER_STEP 8
+
+static const uint64_t powersOfTen[] = {
+  1ull, 10ull, 100ull, 1000ull, 10000ull, 100000ull, 1000000ull, 10000000ull, 100000000ull,
+  1000000000ull, 10000000000ull, 100000000000ull, 1000000000000ull, 10000000000000ull,
+  100000000000000ull, 1000000000000000ull, 10000000000000000ull, 100000000000000000ull,
+  1000000000000000000ull, 10000000000000000000ull
+};
+
+// Every power of ten up to 10^22 is exactly representable as a double.
+static const double exactPowers[] = {
+  1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+  1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+#define EXACT_POWER_MAX 22
+
+static DiyFp diyFpFromDouble(double number) {
+  uint64_t bits;
+  memcpy(&bits, &number, sizeof(bits));
+
+  int exponent = (int)((bits >> 52) & 0x7FF);
+  uint64_t significand = bits & DOUBLE_SIGNIFICAND_MASK;
+
+  if (exponent == 0) return (DiyFp){significand, 1 - DOUBLE_EXPONENT_BIAS};
+  return (DiyFp){significand + DOUBLE_HIDDEN_BIT, exponent - DOUBLE_EXPONENT_BIAS};
+}
+
+static DiyFp multiplyDiyFp(DiyFp x, DiyFp y) {
+  unsigned __int128 product = (unsigned __int128)x.f * y.f;
+  uint64_t high = (uint64_t)(product >> 64);
+  uint64_t low = (uint64_t)product;
+
+  return (DiyFp){high + (low >> 63), x.e + y.e + 64};
+}
+
+static DiyFp normalizeDiyFp(DiyFp x) {
+  int shift = __builtin_clzll(x.f);
+  return (DiyFp){x.f << shift, x.e - shift};
+}
+
+// Computes the midpoints between number and its neighbours, both with the
+// exponent of the normalized upper one.
+static void boundaries(DiyFp v, DiyFp* minus, DiyFp* plus) {
+  DiyFp upper = {(v.f << 1) + 1, v.e - 1};
+  while (!(upper.f & (DOUBLE_HIDDEN_BIT << 1))) {
+    upper.f <<= 1;
+    upper.e--;
+  }
+  upper.f <<= 10;
+  upper.e -= 10;
+
+  // The gap below a power of two is half the gap above it.
+  DiyFp lower = v.f == DOUBLE_HIDDEN_BIT ? (DiyFp){(v.f << 2) - 1, v.e - 2} : (DiyFp){(v.f << 1) - 1, v.e - 1};
+  lower.f <<= lower.e - upper.e;
+  lower.e = upper.e;
+
+  *minus = lower;
+  *plus = upper;
+}
+
+// Picks the cached power that brings a number with binary exponent e into
+// the range the digit generator expects, and returns its decimal exponent.
+static DiyFp cachedPower(int e, int* decimalExponent) {
+  double estimate = (-61 - e) * 0.30102999566398114 + 347;
+  int k = (int)estimate;
+  if (estimate - k > 0.0) k++;
+
+  int index = (k >> 3) + 1;
+  *decimalExponent = -(CACHED_POWER_MIN_EXPONENT + index * CACHED_POWER_STEP);
+  return cachedPowers[index];
+}
+
+static int countDigits(uint32_t n) {
+  int count = 1;
+  while (count < 10 && n >= powersOfTen[count]) count++;
+  return count;
+}
+
+// Moves the last digit towards the exact value while the result stays
+// inside the rounding interval.
+static void roundWeed(char* digits, int length, uint64_t delta, uint64_t rest, uint64_t tenKappa, uint64_t distance) {
+  while (rest < distance && delta - rest >= tenKappa &&
+         (rest + tenKappa < distance || distance - rest > rest + tenKappa - distance)) {
+    digits[length - 1]--;
+    rest += tenKappa;
+  }
+}
+
+static int generateDigits(DiyFp w, DiyFp upper, uint64_t delta, char* digits, int* decimalExponent) {
+  DiyFp one = {1ull << -upper.e, upper.e};
+  uint64_t distance = upper.f - w.f;
+  uint32_t integral = (uint32_t)(upper.f >> -one.e);
+  uint64_t fraction = upper.f & (one.f - 1);
+
+  int length = 0;
+  int kappa = countDigits(integral);
+
+  while (kappa > 0) {
+    uint32_t power = (uint32_t)powersOfTen[kappa - 1];
+    uint32_t digit = integral / power;
+    integral %= power;
+    if (digit != 0 || length != 0) digits[length++] = (char)('0' + digit);
+    kappa--;
+
+    uint64_t rest = ((uint64_t)integral << -one.e) + fraction;
+    if (rest <= delta) {
+      *decimalExponent += kappa;
+      roundWeed(digits, length, delta, rest, powersOfTen[kappa] << -one.e, distance);
+      return length;
+    }
+  }
+
+  for (;;) {
+    fraction *= 10;
+    delta *= 10;
+    char digit = (char)(fraction >> -one.e);
+    if (digit != 0 || length != 0) digits[length++] = (char)('0' + digit);
+    fraction &= one.f - 1;
+    kappa--;
+
+    if (fraction < delta) {
+      *decimalExponent += kappa;
+      int index = -kappa;
+      roundWeed(digits, length, delta, fraction, one.f, distance * (index < 20 ? powersOfTen[index] : 0));
+      return length;
+    }
+  }
+}
+
+// Produces the digits of a positive finite number and the decimal exponent
+// such that number = digits * 10^exponent.
+static int grisu2(double number, char* digits, int* exponent) {
+  DiyFp v = diyFpFromDouble(number);
+  DiyFp minus;
+  DiyFp plus;
+  boundaries(v, &minus, &plus);
+
+  int cachedExponent;
+  DiyFp power = cachedPower(plus.e, &cachedExponent);
+
+  DiyFp w = multiplyDiyFp(normalizeDiyFp(v), power);
+  DiyFp upper = multiplyDiyFp(plus, power);
+  DiyFp lower = multiplyDiyFp(minus, power);
+  upper.f--;
+  lower.f++;
+
+  *exponent = cachedExponent;
+  return generateDigits(w, upper, upper.f - lower.f, digits, exponent);
+}
+
+static int writeExponent(int exponent, char* buffer) {
+  int length = 0;
+  buffer[length++] = 'e';
+  buffer[length++] = exponent < 0 ? '-' : '+';
+  if (exponent < 0) exponent = -exponent;
+
+  if (exponent >= 100) buffer[length++] = (char)('0' + exponent / 100);
+  if (exponent >= 10) buffer[length++] = (char)('0' + exponent / 10 % 10);
+  buffer[length++] = (char)('0' + exponent % 10);
+  return length;
+}
+
+// Lays out digits * 10^exponent the way print shows numbers: plain decimal
+// notation for moderate magnitudes and d.ddde+x outside them.
+static int layoutDigits(const char* digits, int count, int exponent, char* buffer) {
+  int point = count + exponent;
+  int length = 0;
+
+  if (count <= point && point <= 21) {
+    memcpy(buffer, digits, count);
+    length = count;
+    while (length < point) buffer[length++] = '0';
+  } else if (0 < point && point <= 21) {
+    memcpy(buffer, digits, point);
+    buffer[point] = '.';
+    memcpy(buffer + point + 1, digits + point, count - point);
+    length = count + 1;
+  } else if (-6 < point && point <= 0) {
+    buffer[length++] = '0';
+    buffer[length++] = '.';
+    while (point < 0) {
+      buffer[length++] = '0';
+      point++;
+    }
+    memcpy(buffer + length, digits, count);
+    length += count;
+  } else {
+    buffer[length++] = digits[0];
+    if (count > 1) {
+      buffer[length++] = '.';
+      memcpy(buffer + length, digits + 1, count - 1);
+      length += count - 1;
+    }
+    length += writeExponent(point - 1, buffer + length);
+  }
+
+  buffer[length] = '\0';
+  return length;
+}
+
+static int formatSpecial(double number, char* buffer) {
+  const char* text = number != number ? "nan" : number > 0 ? "inf" : "-inf";
+  int length = (int)strlen(text);
+  memcpy(buffer, text, length + 1);
+  return length;
+}
+
+// Writes the shortest text that reads back as number into buffer and
+// returns its length.
+int formatNumber(double number, char* buffer) {
+  if (number != number || number - number != 0) return formatSpecial(number, buffer);
+
+  int length = 0;
+  if (number < 0 || (number == 0 && 1 / number < 0)) {
+    buffer[length++] = '-';
+    number = -number;
+  }
+
+  if (number == 0) {
+    buffer[length++] = '0';
+    buffer[length] = '\0';
+    return length;
+  }
+
+  char digits[18];
+  int exponent;
+  int count = grisu2(number, digits, &exponent);
+  return length + layoutDigits(digits, count, exponent, buffer + length);
+}
+
+int formatInteger(int64_t integer, char* buffer) {
+  char digits[20];
+  int count = 0;
+
+  // Negating in unsigned arithmetic handles INT64_MIN.
+  uint64_t magnitude = integer < 0 ? 0 - (uint64_t)integer : (uint64_t)integer;
+  do {
+    digits[count++] = (char)('0' + magnitude % 10);
+    magnitude /= 10;
+  } while (magnitude != 0);
+
+  int length = 0;
+  if (integer < 0) buffer[length++] = '-';
+  while (count > 0) buffer[length++] = digits[--count];
+
+  buffer[length] = '\0';
+  return length;
+}
+
+// Writes number with exactly digits decimals. The common case scales it
+// into an integer and rounds there; values too large for that, or too close
+// to a rounding tie for the scaled double to be trusted, go through
+// snprintf, which rounds the exact binary value. Magnitudes of 1e21 and up
+// use the shortest form instead.
+int formatFixed(double number, int digits, char* buffer) {
+  if (number != number || number - number != 0) return formatSpecial(number, buffer);
+  if (number >= 1e21 || number <= -1e21) return formatNumber(number, buffer);
+
+  double magnitude = number < 0 ? -number : number;
+  double scaled = magnitude * (digits <= EXACT_POWER_MAX ? exactPowers[digits] : 1e300);
+
+  if (digits > 15 || scaled >= 0x1p53) {
+    return snprintf(buffer, NUMBER_BUFFER_SIZE, "%.*f", digits, number);
+  }
+
+  uint64_t whole = (uint64_t)scaled;
+  double remainder = scaled - (double)whole;
+  double tolerance = scaled * 0x1p-50 + 0x1p-60;
+  if (remainder > 0.5 - tolerance && remainder < 0.5 + tolerance) {
+    return snprintf(buffer, NUMBER_BUFFER_SIZE, "%.*f", digits, number);
+  }
+  if (remainder > 0.5) whole++;
+
+  int length = 0;
+  if (number < 0 || (number == 0 && 1 / number < 0)) buffer[length++] = '-';
+
+  char text[NUMBER_BUFFER_SIZE];
+  int count = formatInteger((int64_t)whole, text);
+
+  // Zero-padded on the left so there is a digit before the point.
+  int width = count > digits ? count : digits + 1;
+  for (int i = 0; i < width; i++) {
+    if (i == width - digits) buffer[length++] = '.';
+    buffer[length++] = i < width - count ? '0' : text[i - (width - count)];
+  }
+
+  buffer[length] = '\0';
+  return length;
+}
+
+static bool isDigit(char c) {
+  return c >= '0' && c <= '9';
+}
+
+// Parses an optionally signed decimal number with optional fraction and
+// exponent from the start of chars, stores it in number and returns how
+// many characters it used, or 0 if there is no number there. Up to 19
+// significant digits are gathered in an integer; when those and the
+// decimal exponent are small enough the result is a single correctly
+// rounded multiplication or division (Clinger's fast path). Anything else
+// falls back to strtod() on a NUL-terminated copy.
+int parseNumber(const char* chars, int length, double* number) {
+  int i = 0;
+  bool negative = false;
+  if (i < length && (chars[i] == '-' || chars[i] == '+')) {
+    negative = chars[i] == '-';
+    i++;
+  }
+
+  uint64_t mantissa = 0;
+  int significant = 0;
+  int exponent = 0;
+  bool truncated = false;
+  int digitCount = 0;
+
+  for (; i < length && isDigit(chars[i]); i++, digitCount++) {
+    if (significant < 19) {
+      mantissa = mantissa * 10 + (uint64_t)(chars[i] - '0');
+      if (mantissa != 0) significant++;
+    } else {
+      exponent++;
+      if (chars[i] != '0') truncated = true;
+    }
+  }
+
+  if (i < length && chars[i] == '.' && i + 1 < length && isDigit(chars[i + 1])) {
+    for (i++; i < length && isDigit(chars[i]); i++, digitCount++) {
+      if (significant < 19) {
+        mantissa = mantissa * 10 + (uint64_t)(chars[i] - '0');
+        if (mantissa != 0) significant++;
+        exponent--;
+      } else if (chars[i] != '0') {
+        truncated = true;
+      }
+    }
+  }
+
+  if (digitCount == 0) return 0;
+
+  if (i < length && (chars[i] == 'e' || chars[i] == 'E')) {
+    int j = i + 1;
+    bool negativeExponent = false;
+    if (j < length && (chars[j] == '-' || chars[j] == '+')) {
+      negativeExponent = chars[j] == '-';
+      j++;
+    }
+
+    if (j < length && isDigit(chars[j])) {
+      int value = 0;
+      for (; j < length && isDigit(chars[j]); j++) {
+        if (value < 100000) value = value * 10 + (chars[j] - '0');
+      }
+
+      exponent += negativeExponent ? -value : value;
+      i = j;
+    }
+  }
+
+  if (mantissa == 0 && !truncated) {
+    *number = negative ? -0.0 : 0.0;
+    return i;
+  }
+
+  if (!truncated && mantissa <= (1ull << 53) && exponent >= -EXACT_POWER_MAX && exponent <= EXACT_POWER_MAX) {
+    double value = (double)mantissa;
+    value = exponent < 0 ? value / exactPowers[-exponent] : value * exactPowers[exponent];
+    *number = negative ? -value : value;
+    return i;
+  }
+
+  char small[64];
+  char* copy = i < (int)sizeof(small) ? small : (char*)malloc(i + 1);
+  if (copy == NULL) {
+    fprintf(stderr, "Out of memory while parsing a number\n");
+    exit(1);
+  }
+
+  memcpy(copy, chars, i);
+  copy[i] = '\0';
+  *number = strtod(copy, NULL);
+  if (copy != small) free(copy);
+
+  return i;
+}
@@ -1,7 +1,9 @@
 #include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
+#include "../include/intern.h"
 #include "../include/memory.h"
 #include "../include/object.h"
 #include "../include/value.h"
@@ -9,17 +11,18 @@
 #include "../include/vm.h"
 
 #define ALLOCATE_OBJECT(type, objectType) (type*)allocateObject(sizeof(type), objectType)
+#define ALLOCATE_FLEX_OBJECT(type, elementType, count, objectType) \
+  (type*)allocateObject(sizeof(type) + sizeof(elementType) * (count), objectType)
 
 static Object* allocateObject(size_t size, ObjectType type) {
-  Object* object = (Object*)reallocate(NULL, 0, size);
-  object->type = type;
-  object->isMarked = false;
-
-  object->next = vm.objects;
-  vm.objects = object;
+  Object* object = (Object*)allocateCell(size);
+  object->type = (uint8_t)type;
+  object->gcBits = 0;
 
   #ifdef DEBUG_LOG_GARBAGE_COLLECT
+    if (vm.debug.logGC) {
       printf("%p allocate %zu for %d\n", (void*)object, size, type);
+    }
   #endif
 
   return object;
@@ -33,19 +36,46 @@ ObjectClass* newClass(ObjectString* name) {
 }
 
 ObjectClosure* newClosure(ObjectFunction* function) {
-  ObjectUpvalue** upvalues = ALLOCATE(ObjectUpvalue*, function->upvalueCount);
+  ObjectClosure* closure = ALLOCATE_FLEX_OBJECT(ObjectClosure, ObjectUpvalue*, function->upvalueCount, OBJECT_CLOSURE);
+  closure->function = function;
+  closure->upvalueCount = function->upvalueCount;
 
   for (int i = 0; i < function->upvalueCount; i++) {
-    upvalues[i] = NULL;
+    closure->upvalues[i] = NULL;
   }
 
-  ObjectClosure* closure = ALLOCATE_OBJECT(ObjectClosure, OBJECT_CLOSURE);
-  closure->function = function;
-  closure->upvalues = upvalues;
-  closure->upvalueCount = function->upvalueCount;
   return closure;
 }
 
+// Starts closed; the caller opens the descriptor once the object is rooted.
+ObjectFile* newFile() {
+  ObjectFile* file = ALLOCATE_OBJECT(ObjectFile, OBJECT_FILE);
+  file->fd = -1;
+  file->readable = false;
+  file->writable = false;
+  file->eof = false;
+  file->input = NULL;
+  file->inputStart = 0;
+  file->inputEnd = 0;
+  file->inputCapacity = 0;
+  initOutput(&file->output, OUTPUT_MEMORY, OUTPUT_DEFAULT_SIZE);
+  return file;
+}
+
+// The values are left uninitialized for the caller to fill in.
+ObjectFloat64Array* newFloat64Array(int length) {
+  ObjectFloat64Array* array = ALLOCATE_OBJECT(ObjectFloat64Array, OBJECT_FLOAT64_ARRAY);
+  array->length = 0;
+  array->values = NULL;
+
+  push(OBJECT_VAL(array));
+  array->values = ALLOCATE(double, length);
+  array->length = length;
+  pop();
+
+  return array;
+}
+
 ObjectFunction* newFunction() {
   ObjectFunction* function = ALLOCATE_OBJECT(ObjectFunction, OBJECT_FUNCTION);
   function->arity = 0;
@@ -62,56 +92,278 @@ ObjectInstance* newInstance(ObjectClass* _class) {
   return instance;
 }
 
+ObjectList* newList() {
+  ObjectList* list = ALLOCATE_OBJECT(ObjectList, OBJECT_LIST);
+  initValueArray(&list->items);
+  return list;
+}
+
+ObjectMap* newMap() {
+  ObjectMap* map = ALLOCATE_OBJECT(ObjectMap, OBJECT_MAP);
+  initMap(&map->map);
+  return map;
+}
+
 ObjectNative* newNative(NativeFn function) {
   ObjectNative* native = ALLOCATE_OBJECT(ObjectNative, OBJECT_NATIVE);
   native->function = function;
   return native;
 }
 
-static ObjectString* allocateString(char* chars, int length, uint32_t hash) {
-  ObjectString* string = ALLOCATE_OBJECT(ObjectString, OBJECT_STRING);
+// Takes ownership of chars, which must come from malloc() or, if mapped is
+// set, from mmap() with exactly length bytes.
+ObjectSource* newSource(char* chars, int length, bool mapped) {
+  ObjectSource* source = ALLOCATE_OBJECT(ObjectSource, OBJECT_SOURCE);
+  source->length = length;
+  source->mapped = mapped;
+  source->chars = chars;
+  return source;
+}
+
+// Characters are stored inline after the header. The caller fills in
+// exactly length bytes; the terminating NUL is written here.
+ObjectString* allocateString(int length) {
+  ObjectString* string = ALLOCATE_FLEX_OBJECT(ObjectString, char, length + 1, OBJECT_STRING);
   string->length = length;
-  string->chars = chars;
-  string->hash = hash;
+  string->hash = 0;
+  string->chars = string->storage;
+  string->chars[length] = '\0';
+  return string;
+}
 
-  push(OBJECT_VAL(string));
-  tableSet(&vm.strings, string, NULL_VAL);
-  pop();
+static inline uint64_t readWord(const char* chars) {
+  uint64_t word;
+  memcpy(&word, chars, sizeof(word));
+  return word;
+}
 
-  return string;
+static inline uint32_t readHalfWord(const char* chars) {
+  uint32_t word;
+  memcpy(&word, chars, sizeof(word));
+  return word;
+}
+
+static inline uint64_t mixWords(uint64_t a, uint64_t b) {
+  __uint128_t product = (__uint128_t)a * b;
+  return (uint64_t)product ^ (uint64_t)(product >> 64);
 }
 
-static uint32_t hashString(const char* key, int length) {
-  uint32_t hash = 2166136261u;
-  for (int i = 0; i < length; i++) {
-    hash ^= (uint32_t)key[i];
-    hash *= 16777619;
+// Multiply-mix hash that consumes sixteen bytes per step. Tails are read
+// as overlapping words, so no input is ever handled a byte at a time
+// beyond the last three.
+uint32_t hashString(const char* chars, int length) {
+  const uint64_t prime0 = 0xa0761d6478bd642full;
+  const uint64_t prime1 = 0xe7037ed1a0b428dbull;
+  uint64_t seed = prime0 ^ (uint64_t)length;
+
+  int i = 0;
+  for (; i + 16 <= length; i += 16) {
+    seed = mixWords(readWord(chars + i) ^ prime1, readWord(chars + i + 8) ^ seed);
+  }
+
+  int remaining = length - i;
+  uint64_t a = 0;
+  uint64_t b = 0;
+
+  if (remaining >= 8) {
+    a = readWord(chars + i);
+    b = readWord(chars + length - 8);
+  } else if (remaining >= 4) {
+    a = readHalfWord(chars + i);
+    b = readHalfWord(chars + length - 4);
+  } else if (remaining > 0) {
+    a = ((uint64_t)(uint8_t)chars[i] << 16) | ((uint64_t)(uint8_t)chars[i + remaining / 2] << 8) | (uint8_t)chars[length - 1];
   }
 
-  return hash;
+  uint64_t hash = mixWords(mixWords(a ^ prime1, b ^ seed), prime1 ^ (uint64_t)length);
+  return (uint32_t)(hash ^ (hash >> 32));
 }
 
-ObjectString* takeString(char* chars, int length) {
-  uint32_t hash = hashString(chars, length);
-  ObjectString* interned = tableFindString(&vm.strings, chars, length, hash);
-  if (interned != NULL) {
-    FREE_ARRAY(char, chars, length + 1);
-    return interned;
+uint32_t stringHash(ObjectString* string) {
+  if (!(string->object.gcBits & STRING_HASHED)) {
+    string->hash = hashString(string->chars, string->length);
+    string->object.gcBits |= STRING_HASHED;
   }
 
-  return allocateString(chars, length, hash);
+  return string->hash;
 }
 
+// Returns the canonical copy of string, adding string itself to the intern
+// set if no equal string is there yet. Anything used as a table key must
+// go through here first.
+ObjectString* internString(ObjectString* string) {
+  if (string->object.gcBits & STRING_INTERNED) return string;
+
+  uint32_t hash = stringHash(string);
+  ObjectString* interned = internSetFind(&vm.strings, string->chars, string->length, hash);
+  if (interned != NULL) return interned;
+
+  push(OBJECT_VAL(string));
+  internSetAdd(&vm.strings, string);
+  pop();
+
+  string->object.gcBits |= STRING_INTERNED;
+  return string;
+}
+
+// Two interned strings are equal only if they are the same object. Hashes
+// are compared only when both are already cached, since hashing just to
+// compare costs more than the memcmp it would save.
+bool stringsEqual(ObjectString* a, ObjectString* b) {
+  if (a == b) return true;
+  if (a->length != b->length) return false;
+  if ((a->object.gcBits & b->object.gcBits & STRING_INTERNED)) return false;
+  if ((a->object.gcBits & b->object.gcBits & STRING_HASHED) && a->hash != b->hash) return false;
+
+  return memcmp(a->chars, b->chars, a->length) == 0;
+}
+
+// Used for identifiers and literals, which are likely to end up as keys,
+// so the copy is interned straight away.
 ObjectString* copyString(const char* chars, int length) {
   uint32_t hash = hashString(chars, length);
-  ObjectString* interned = tableFindString(&vm.strings, chars, length, hash);
+  ObjectString* interned = internSetFind(&vm.strings, chars, length, hash);
+  if (interned != NULL) return interned;
+
+  ObjectString* string = allocateString(length);
+  memcpy(string->chars, chars, length);
+  string->hash = hash;
+  string->object.gcBits |= STRING_HASHED;
+
+  return internString(string);
+}
+
+// Returns an interned string for chars without copying them; owner must
+// keep the characters alive and unmoved for as long as it is reachable.
+ObjectString* borrowString(Object* owner, const char* chars, int length, uint32_t hash) {
+  ObjectString* interned = internSetFind(&vm.strings, chars, length, hash);
   if (interned != NULL) return interned;
 
-  char* heapChars = ALLOCATE(char, length + 1);
-  memcpy(heapChars, chars, length);
-  heapChars[length] = '\0';
+  ObjectString* string = ALLOCATE_FLEX_OBJECT(ObjectString, Object*, 1, OBJECT_STRING);
+  string->length = length;
+  string->hash = hash;
+  string->chars = (char*)chars;
+  STRING_OWNER(string) = owner;
+  string->object.gcBits |= STRING_HASHED | STRING_BORROWED;
 
-  return allocateString(heapChars, length, hash);
+  return internString(string);
+}
+
+// Substrings shorter than this are copied: the copy is about as small as
+// a view and does not keep the whole parent alive.
+#define STRING_VIEW_MIN_LENGTH 16
+
+// Returns a string over length characters kept alive by owner. Like other
+// runtime strings it is neither hashed nor interned until something needs it.
+ObjectString* newBorrowedString(Object* owner, const char* chars, int length) {
+  ObjectString* string = ALLOCATE_FLEX_OBJECT(ObjectString, Object*, 1, OBJECT_STRING);
+  string->length = length;
+  string->hash = 0;
+  string->chars = (char*)chars;
+  STRING_OWNER(string) = owner;
+  string->object.gcBits |= STRING_BORROWED;
+
+  return string;
+}
+
+// Returns the length characters of parent starting at start. Longer
+// results are views that share parent's characters, or those of the buffer
+// parent itself borrows from.
+ObjectString* newStringView(ObjectString* parent, int start, int length) {
+  if (start == 0 && length == parent->length) return parent;
+
+  if (length < STRING_VIEW_MIN_LENGTH) {
+    ObjectString* string = allocateString(length);
+    memcpy(string->chars, parent->chars + start, length);
+    return string;
+  }
+
+  Object* owner = parent->object.gcBits & STRING_BORROWED ? STRING_OWNER(parent) : (Object*)parent;
+  return newBorrowedString(owner, parent->chars + start, length);
+}
+
+ObjectRope* newRope(Object* left, Object* right, int length) {
+  ObjectRope* rope = ALLOCATE_OBJECT(ObjectRope, OBJECT_ROPE);
+  rope->length = length;
+  rope->left = left;
+  rope->right = right;
+  rope->flat = NULL;
+  return rope;
+}
+
+// Visits the flat pieces of a rope from left to right. Uses an explicit
+// stack so the long left-leaning chains built by repeated appends cannot
+// overflow the C stack. Never allocates on the GC heap; if the stack itself
+// cannot grow, the out-of-memory runtime error is raised once it is freed.
+void forEachRopePiece(ObjectRope* rope, void (*visit)(ObjectString* piece, void* context), void* context) {
+  int capacity = 16;
+  int count = 0;
+  Object** pending = (Object**)malloc(sizeof(Object*) * capacity);
+  if (pending == NULL) throwRuntimeError("Out of memory: could not allocate %zu bytes", sizeof(Object*) * capacity);
+
+  pending[count++] = (Object*)rope;
+
+  while (count > 0) {
+    Object* node = pending[--count];
+
+    if (node->type == OBJECT_STRING) {
+      visit((ObjectString*)node, context);
+    } else if (((ObjectRope*)node)->flat != NULL) {
+      visit(((ObjectRope*)node)->flat, context);
+    } else {
+      if (capacity < count + 2) {
+        Object** grown = (Object**)realloc(pending, sizeof(Object*) * capacity * 2);
+        if (grown == NULL) {
+          free(pending);
+          throwRuntimeError("Out of memory: could not allocate %zu bytes", sizeof(Object*) * capacity * 2);
+        }
+        pending = grown;
+        capacity *= 2;
+      }
+
+      pending[count++] = ((ObjectRope*)node)->right;
+      pending[count++] = ((ObjectRope*)node)->left;
+    }
+  }
+
+  free(pending);
+}
+
+static void copyPiece(ObjectString* piece, void* context) {
+  char** dest = (char**)context;
+  memcpy(*dest, piece->chars, piece->length);
+  *dest += piece->length;
+}
+
+static void printPiece(ObjectString* piece, void* context) {
+  writeOutput((OutputBuffer*)context, piece->chars, piece->length);
+}
+
+ObjectString* flattenRope(ObjectRope* rope) {
+  if (rope->flat != NULL) return rope->flat;
+
+  push(OBJECT_VAL(rope));
+  ObjectString* string = allocateString(rope->length);
+  push(OBJECT_VAL(string));
+
+  char* dest = string->chars;
+  forEachRopePiece(rope, copyPiece, &dest);
+
+  rope->flat = string;
+  rope->left = NULL;
+  rope->right = NULL;
+  pop();
+  pop();
+
+  return rope->flat;
+}
+
+ObjectStringBuilder* newStringBuilder() {
+  ObjectStringBuilder* builder = ALLOCATE_OBJECT(ObjectStringBuilder, OBJECT_STRING_BUILDER);
+  builder->length = 0;
+  builder->capacity = 0;
+  builder->chars = NULL;
+  return builder;
 }
 
 ObjectUpvalue* newUpvalue(Value* slot) {
@@ -122,37 +374,129 @@ ObjectUpvalue* newUpvalue(Value* slot) {
   return upvalue;
 }
 
-static void printFunction(ObjectFunction* function) {
+static void printFunction(OutputBuffer* output, ObjectFunction* function) {
   if (function->name == NULL) {
-    printf("<script>");
+    WRITE_LITERAL(output, "<script>");
     return;
   }
 
-  printf("<fn %s>", function->name->chars);
+  WRITE_LITERAL(output, "<fn ");
+  writeOutput(output, function->name->chars, function->name->length);
+  WRITE_LITERAL(output, ">");
 }
 
-void printObject(Value value) {
+static void printFloat64Array(OutputBuffer* output, ObjectFloat64Array* array) {
+  WRITE_LITERAL(output, "Float64Array[");
+  for (int i = 0; i < array->length; i++) {
+    if (i > 0) WRITE_LITERAL(output, ", ");
+    writeValue(output, NUMBER_VAL(array->values[i]));
+  }
+  WRITE_LITERAL(output, "]");
+}
+
+// Containers being printed, innermost last. One that contains itself is
+// shown as [...] or {...} the second time round, and nesting deeper than
+// this is cut off the same way rather than exhausting the C stack.
+#define PRINT_MAX_DEPTH 256
+
+static Object* printing[PRINT_MAX_DEPTH];
+static int printingCount = 0;
+
+static bool beginPrinting(Object* object) {
+  if (printingCount == PRINT_MAX_DEPTH) return false;
+  for (int i = 0; i < printingCount; i++) {
+    if (printing[i] == object) return false;
+  }
+
+  printing[printingCount++] = object;
+  return true;
+}
+
+static void endPrinting() {
+  printingCount--;
+}
+
+static void printList(OutputBuffer* output, ObjectList* list) {
+  if (!beginPrinting((Object*)list)) {
+    WRITE_LITERAL(output, "[...]");
+    return;
+  }
+
+  WRITE_LITERAL(output, "[");
+  for (int i = 0; i < list->items.count; i++) {
+    if (i > 0) WRITE_LITERAL(output, ", ");
+    writeValue(output, list->items.values[i]);
+  }
+  WRITE_LITERAL(output, "]");
+  endPrinting();
+}
+
+static void printMap(OutputBuffer* output, ObjectMap* map) {
+  if (!beginPrinting((Object*)map)) {
+    WRITE_LITERAL(output, "{...}");
+    return;
+  }
+
+  WRITE_LITERAL(output, "{");
+  bool first = true;
+  for (int i = 0; i < map->map.entryCount; i++) {
+    MapEntry* entry = &map->map.entries[i];
+    if (entry->deleted) continue;
+
+    if (!first) WRITE_LITERAL(output, ", ");
+    first = false;
+    writeValue(output, entry->key);
+    WRITE_LITERAL(output, ": ");
+    writeValue(output, entry->value);
+  }
+  WRITE_LITERAL(output, "}");
+  endPrinting();
+}
+
+void writeObject(OutputBuffer* output, Value value) {
   switch (OBJECT_TYPE(value)) {
     case OBJECT_CLASS:
-      printf("%s", AS_CLASS(value)->name->chars);
+      writeOutput(output, AS_CLASS(value)->name->chars, AS_CLASS(value)->name->length);
       break;
     case OBJECT_CLOSURE:
-      printFunction(AS_CLOSURE(value)->function);
+      printFunction(output, AS_CLOSURE(value)->function);
+      break;
+    case OBJECT_FILE:
+      WRITE_LITERAL(output, "<file>");
+      break;
+    case OBJECT_FLOAT64_ARRAY:
+      printFloat64Array(output, AS_FLOAT64_ARRAY(value));
       break;
     case OBJECT_FUNCTION:
-      printFunction(AS_FUNCTION(value));
+      printFunction(output, AS_FUNCTION(value));
       break;
     case OBJECT_INSTANCE:
-      printf("%s instance", AS_INSTANCE(value)->_class->name->chars);
+      writeOutput(output, AS_INSTANCE(value)->_class->name->chars, AS_INSTANCE(value)->_class->name->length);
+      WRITE_LITERAL(output, " instance");
+      break;
+    case OBJECT_LIST:
+      printList(output, AS_LIST(value));
+      break;
+    case OBJECT_MAP:
+      printMap(output, AS_MAP(value));
       break;
     case OBJECT_NATIVE:
-      printf("<native fn>");
+      WRITE_LITERAL(output, "<native fn>");
+      break;
+    case OBJECT_ROPE:
+      forEachRopePiece(AS_ROPE(value), printPiece, output);
+      break;
+    case OBJECT_SOURCE:
+      WRITE_LITERAL(output, "<source>");
       break;
     case OBJECT_STRING:
-      printf("%s", AS_CSTRING(value));
+      writeOutput(output, AS_STRING(value)->chars, AS_STRING(value)->length);
+      break;
+    case OBJECT_STRING_BUILDER:
+      WRITE_LITERAL(output, "<string builder>");
       break;
     case OBJECT_UPVALUE:
-      printf("upvalue");
+      WRITE_LITERAL(output, "upvalue");
       break;
   }
 }
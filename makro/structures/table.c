@@ -2,100 +2,224 @@
 #include <stdlib.h>
 #include <string.h>
 
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "../include/heap.h"
 #include "../include/memory.h"
 #include "../include/object.h"
 #include "../include/table.h"
 #include "../include/value.h"
 
-#define TABLE_MAX_LOAD 0.75
+// Each slot has a control byte next to the entry array: CONTROL_EMPTY,
+// CONTROL_DELETED or, for a full slot, the top seven bits of the key's hash.
+// Probes scan a whole group of control bytes at once and only touch the
+// entries whose fragment matches.
+#define CONTROL_EMPTY 0x80
+#define CONTROL_DELETED 0xFE
+
+#define TABLE_GROUP_WIDTH 16
+#define TABLE_MIN_CAPACITY 16
+#define TABLE_BYTES(capacity) ((size_t)(capacity) * (sizeof(Entry) + 1))
+
+#define HASH_GROUP(hash) ((hash) / TABLE_GROUP_WIDTH)
+#define HASH_FRAGMENT(hash) ((uint8_t)((hash) >> 25))
+
+typedef uint32_t GroupMask;
+
+#ifdef __SSE2__
+
+static inline GroupMask matchByte(const uint8_t* group, uint8_t byte) {
+  __m128i control = _mm_loadu_si128((const __m128i*)group);
+  return (GroupMask)_mm_movemask_epi8(_mm_cmpeq_epi8(control, _mm_set1_epi8((char)byte)));
+}
+
+// Empty and deleted are the only control bytes with the high bit set.
+static inline GroupMask matchFree(const uint8_t* group) {
+  return (GroupMask)_mm_movemask_epi8(_mm_loadu_si128((const __m128i*)group));
+}
+
+#else
+
+static inline GroupMask matchByte(const uint8_t* group, uint8_t byte) {
+  GroupMask mask = 0;
+  for (int i = 0; i < TABLE_GROUP_WIDTH; i++) {
+    if (group[i] == byte) mask |= (GroupMask)1 << i;
+  }
+
+  return mask;
+}
+
+static inline GroupMask matchFree(const uint8_t* group) {
+  GroupMask mask = 0;
+  for (int i = 0; i < TABLE_GROUP_WIDTH; i++) {
+    if (group[i] & 0x80) mask |= (GroupMask)1 << i;
+  }
+
+  return mask;
+}
+
+#endif
+
+static inline int firstSlot(GroupMask mask) {
+  return __builtin_ctz(mask);
+}
+
+// Groups are visited in triangular order, which covers every group of a
+// power-of-two table exactly once.
+static inline uint32_t nextGroup(uint32_t group, uint32_t step, uint32_t groupMask) {
+  return (group + step) & groupMask;
+}
 
 void initTable(Table* table) {
   table->count = 0;
+  table->tombstones = 0;
   table->capacity = 0;
   table->entries = NULL;
+  table->control = NULL;
 }
 
 void freeTable(Table* table) {
-  FREE_ARRAY(Entry, table->entries, table->capacity);
+  reallocate(table->entries, TABLE_BYTES(table->capacity), 0);
   initTable(table);
 }
 
-static Entry* findEntry(Entry* entries, int capacity, ObjectString* key) {
-  uint32_t index = key->hash % capacity;
-  Entry* tombstone = NULL;
-  
-  for (;;) {
-    Entry* entry = &entries[index];
-    if (entry->key == NULL) {
-      if (IS_NULL(entry->value)) {
-        return tombstone != NULL ? tombstone : entry;
-      } else {
-        if (tombstone == NULL) tombstone = entry;
-      }
-    } else if (entry->key == key) {
-      return entry;
+// Returns the index of the slot holding key, or -1 if it is not present.
+static int findSlot(Table* table, ObjectString* key) {
+  uint32_t groupMask = table->capacity / TABLE_GROUP_WIDTH - 1;
+  uint32_t group = HASH_GROUP(key->hash) & groupMask;
+  uint8_t fragment = HASH_FRAGMENT(key->hash);
+
+  for (uint32_t step = 1;; step++) {
+    const uint8_t* control = &table->control[group * TABLE_GROUP_WIDTH];
+
+    for (GroupMask match = matchByte(control, fragment); match != 0; match &= match - 1) {
+      int index = group * TABLE_GROUP_WIDTH + firstSlot(match);
+      if (table->entries[index].key == key) return index;
     }
 
-    index = (index + 1) % capacity;
+    if (matchByte(control, CONTROL_EMPTY) != 0) return -1;
+    group = nextGroup(group, step, groupMask);
+  }
+}
+
+// Returns the first empty or deleted slot on the probe sequence of hash.
+static int findFreeSlot(uint8_t* controlBytes, int capacity, uint32_t hash) {
+  uint32_t groupMask = capacity / TABLE_GROUP_WIDTH - 1;
+  uint32_t group = HASH_GROUP(hash) & groupMask;
+
+  for (uint32_t step = 1;; step++) {
+    GroupMask available = matchFree(&controlBytes[group * TABLE_GROUP_WIDTH]);
+    if (available != 0) return group * TABLE_GROUP_WIDTH + firstSlot(available);
+
+    group = nextGroup(group, step, groupMask);
   }
 }
 
+// Rebuilds the table at the given capacity, dropping every tombstone.
 static void adjustCapacity(Table* table, int capacity) {
-  Entry* entries = ALLOCATE(Entry, capacity);
+  Entry* entries = (Entry*)reallocate(NULL, 0, TABLE_BYTES(capacity));
+  uint8_t* control = (uint8_t*)(entries + capacity);
+
   for (int i = 0; i < capacity; i++) {
     entries[i].key = NULL;
     entries[i].value = NULL_VAL;
   }
+  memset(control, CONTROL_EMPTY, capacity);
 
-  table->count = 0;
   for (int i = 0; i < table->capacity; i++) {
     Entry* entry = &table->entries[i];
     if (entry->key == NULL) continue;
 
-    Entry* dest = findEntry(entries, capacity, entry->key);
-    dest->key = entry->key;
-    dest->value = entry->value;
-    table->count++;
+    int index = findFreeSlot(control, capacity, entry->key->hash);
+    control[index] = HASH_FRAGMENT(entry->key->hash);
+    entries[index] = *entry;
   }
 
-  FREE_ARRAY(Entry, table->entries, table->capacity);
+  reallocate(table->entries, TABLE_BYTES(table->capacity), 0);
   table->entries = entries;
+  table->control = control;
   table->capacity = capacity;
+  table->tombstones = 0;
+}
+
+// Keeps full and deleted slots under 7/8 of the table. When tombstones
+// are what fill it the table is rehashed in place instead of grown.
+static void reserveSlot(Table* table) {
+  int used = table->count + table->tombstones + 1;
+  if (used <= table->capacity - table->capacity / 8) return;
+
+  int capacity = table->capacity < TABLE_MIN_CAPACITY ? TABLE_MIN_CAPACITY : table->capacity;
+  if ((table->count + 1) * 2 > capacity) capacity *= 2;
+  adjustCapacity(table, capacity);
+}
+
+// Makes room for count more keys, so adding them never rebuilds the table.
+void tableReserve(Table* table, int count) {
+  int used = table->count + table->tombstones + count;
+  if (used <= table->capacity - table->capacity / 8) return;
+
+  int capacity = table->capacity < TABLE_MIN_CAPACITY ? TABLE_MIN_CAPACITY : table->capacity;
+  while (table->count + count > capacity - capacity / 8) capacity *= 2;
+  adjustCapacity(table, capacity);
 }
 
 bool tableSet(Table* table, ObjectString* key, Value value) {
-  if (table->count + 1 > table->capacity * TABLE_MAX_LOAD) {
-    int capacity = GROW_CAPACITY(table->capacity);
-    adjustCapacity(table, capacity);
+  if (table->count > 0) {
+    int index = findSlot(table, key);
+    if (index >= 0) {
+      table->entries[index].value = value;
+      return false;
+    }
   }
 
-  Entry* entry = findEntry(table->entries, table->capacity, key);
-  bool isNewKey = entry->key == NULL;
-  if (isNewKey && IS_NULL(entry->value)) table->count++;
+  reserveSlot(table);
+
+  int index = findFreeSlot(table->control, table->capacity, key->hash);
+  if (table->control[index] == CONTROL_DELETED) table->tombstones--;
 
-  entry->key = key;
-  entry->value = value;
-  return isNewKey;
+  table->control[index] = HASH_FRAGMENT(key->hash);
+  table->entries[index].key = key;
+  table->entries[index].value = value;
+  table->count++;
+  return true;
 }
 
 bool tableGet(Table* table, ObjectString* key, Value* value) {
   if (table->count == 0) return false;
 
-  Entry* entry = findEntry(table->entries, table->capacity, key);
-  if (entry->key == NULL) return false;
+  int index = findSlot(table, key);
+  if (index < 0) return false;
 
-  *value = entry->value;
+  *value = table->entries[index].value;
   return true;
 }
 
+// A slot can go straight back to empty if its group already has an empty
+// slot, since no probe sequence continues past such a group.
+static void deleteSlot(Table* table, int index) {
+  const uint8_t* group = &table->control[index / TABLE_GROUP_WIDTH * TABLE_GROUP_WIDTH];
+
+  if (matchByte(group, CONTROL_EMPTY) != 0) {
+    table->control[index] = CONTROL_EMPTY;
+  } else {
+    table->control[index] = CONTROL_DELETED;
+    table->tombstones++;
+  }
+
+  table->entries[index].key = NULL;
+  table->entries[index].value = NULL_VAL;
+  table->count--;
+}
+
 bool tableDelete(Table* table, ObjectString* key) {
   if (table->count == 0) return false;
 
-  Entry* entry = findEntry(table->entries, table->capacity, key);
-  if (entry->key == NULL) return false;
+  int index = findSlot(table, key);
+  if (index < 0) return false;
 
-  entry->key = NULL;
-  entry->value = BOOL_VAL(true);
+  deleteSlot(table, index);
   return true;
 }
 
@@ -108,35 +232,18 @@ void tableAddAll(Table* from, Table* to) {
   }
 }
 
-ObjectString* tableFindString(Table* table, const char* chars, int length, uint32_t hash) {
-  if (table->count == 0) return NULL;
-
-  uint32_t index = hash % table->capacity;
-  for (;;) {
-    Entry* entry = &table->entries[index];
-    if (entry->key == NULL) {
-      if (IS_NULL(entry->value)) return NULL;
-    } else if (entry->key->length == length && entry->key->hash == hash && memcmp(entry->key->chars, chars, length) == 0) {
-      return entry->key;
-    }
-
-    index = (index + 1) % table->capacity;
-  }
-}
-
-void tableRemoveWhite(Table *table) {
+void markTable(Table* table) {
   for (int i = 0; i < table->capacity; i++) {
     Entry* entry = &table->entries[i];
-    if (entry->key != NULL && !entry->key->object.isMarked) {
-      tableDelete(table, entry->key);
-    }
+    markObject((Object*)entry->key);
+    markValue(entry->value);
   }
 }
 
-void markTable(Table* table) {
+void forwardTable(Table* table) {
   for (int i = 0; i < table->capacity; i++) {
     Entry* entry = &table->entries[i];
-    markObject((Object*)entry->key);
-    markValue(entry->value);
+    entry->key = (ObjectString*)forwardObject((Object*)entry->key);
+    forwardValue(&entry->value);
   }
 }
@@ -1,9 +1,10 @@
-#include <stdio.h>
 #include <string.h>
 
 #include "../include/object.h"
 #include "../include/memory.h"
+#include "../include/number.h"
 #include "../include/value.h"
+#include "../include/vm.h"
 
 void initValueArray(ValueArray* array) {
   array->values = NULL;
@@ -14,42 +15,128 @@ void initValueArray(ValueArray* array) {
 void writeValueArray(ValueArray* array, Value value) {
   if (array->capacity < array->count + 1) {
     int oldCapacity = array->capacity;
-    array->capacity = GROW_CAPACITY(oldCapacity);
-    array->values = GROW_ARRAY(Value, array->values, oldCapacity, array->capacity);
+    int capacity = GROW_CAPACITY(oldCapacity);
+    array->values = GROW_ARRAY(Value, array->values, oldCapacity, capacity);
+    array->capacity = capacity;
   }
 
   array->values[array->count] = value;
   array->count++;
 }
 
+// Makes room for capacity values in total, so writing that many never
+// reallocates.
+void reserveValueArray(ValueArray* array, int capacity) {
+  if (capacity <= array->capacity) return;
+
+  array->values = GROW_ARRAY(Value, array->values, array->capacity, capacity);
+  array->capacity = capacity;
+}
+
 void freeValueArray(ValueArray* array) {
   FREE_ARRAY(Value, array->values, array->capacity);
   initValueArray(array);
 }
 
-void printValue(Value value) {
+// Succeeds only if number has an integral value that int64_t can hold.
+bool integerFromNumber(double number, int64_t* integer) {
+  if (!(number >= -0x1p63 && number < 0x1p63)) return false;
+
+  *integer = (int64_t)number;
+  return (double)*integer == number;
+}
+
+// Numbers are formatted straight into the buffer when it has room.
+static void writeNumber(OutputBuffer* output, Value value) {
+  char* dest = reserveOutput(output, NUMBER_BUFFER_SIZE);
+  if (dest != NULL) {
+    output->count += IS_INTEGER(value) ? formatInteger(AS_INTEGER(value), dest) : formatNumber(AS_NUMBER(value), dest);
+    return;
+  }
+
+  char buffer[NUMBER_BUFFER_SIZE];
+  int length = IS_INTEGER(value) ? formatInteger(AS_INTEGER(value), buffer) : formatNumber(AS_NUMBER(value), buffer);
+  writeOutput(output, buffer, length);
+}
+
+// Writes value the way print shows it.
+void writeValue(OutputBuffer* output, Value value) {
   switch (value.type) {
     case VAL_BOOL:
-      printf(AS_BOOL(value) ? "true" : "false");
+      if (AS_BOOL(value)) {
+        WRITE_LITERAL(output, "true");
+      } else {
+        WRITE_LITERAL(output, "false");
+      }
       break;
-    case VAL_NULL:
-      printf("null"); break;
+    case VAL_INTEGER:
     case VAL_NUMBER:
-      printf("%g", AS_NUMBER(value));
+      writeNumber(output, value);
+      break;
+    case VAL_NULL:
+      WRITE_LITERAL(output, "null");
       break;
     case VAL_OBJECT:
-      printObject(value);
+      writeObject(output, value);
       break;
   }
 }
 
+void printValue(Value value) {
+  writeValue(&vm.output, value);
+}
+
+// An integer equals a double only if the double holds exactly that
+// integer, which keeps equality consistent with hashValue().
+static bool integerEqualsNumber(int64_t integer, double number) {
+  int64_t converted;
+  return integerFromNumber(number, &converted) && converted == integer;
+}
+
+// The orderings below compare an integer with a double exactly as well, so
+// that a < b, a == b and a > b never disagree about the same pair.
+static bool integerLessThanNumber(int64_t integer, double number) {
+  if (!(number >= -0x1p63)) return false;
+  if (number >= 0x1p63) return true;
+
+  int64_t truncated = (int64_t)number;
+  return integer < truncated || (integer == truncated && number > (double)truncated);
+}
+
+static bool numberLessThanInteger(double number, int64_t integer) {
+  if (!(number < 0x1p63)) return false;
+  if (number < -0x1p63) return true;
+
+  int64_t truncated = (int64_t)number;
+  return truncated < integer || (truncated == integer && number < (double)truncated);
+}
+
+// Both values must be numeric. NaN is never less than anything.
+bool valuesLess(Value a, Value b) {
+  if (IS_INTEGER(a)) {
+    return IS_INTEGER(b) ? AS_INTEGER(a) < AS_INTEGER(b) : integerLessThanNumber(AS_INTEGER(a), AS_NUMBER(b));
+  }
+
+  return IS_INTEGER(b) ? numberLessThanInteger(AS_NUMBER(a), AS_INTEGER(b)) : AS_NUMBER(a) < AS_NUMBER(b);
+}
+
 bool valuesEqual(Value a, Value b) {
-  if (a.type != b.type) return false;
+  if (a.type != b.type) {
+    if (IS_INTEGER(a) && IS_NUMBER(b)) return integerEqualsNumber(AS_INTEGER(a), AS_NUMBER(b));
+    if (IS_NUMBER(a) && IS_INTEGER(b)) return integerEqualsNumber(AS_INTEGER(b), AS_NUMBER(a));
+    return false;
+  }
+
   switch (a.type) {
     case VAL_BOOL: return AS_BOOL(a) == AS_BOOL(b);
+    case VAL_INTEGER: return AS_INTEGER(a) == AS_INTEGER(b);
     case VAL_NULL: return true;
     case VAL_NUMBER: return AS_NUMBER(a) == AS_NUMBER(b);
-    case VAL_OBJECT: return AS_OBJECT(a) == AS_OBJECT(b);
+    case VAL_OBJECT:
+      if (IS_ROPE(a)) a = OBJECT_VAL(flattenRope(AS_ROPE(a)));
+      if (IS_ROPE(b)) b = OBJECT_VAL(flattenRope(AS_ROPE(b)));
+      if (IS_STRING(a) && IS_STRING(b)) return stringsEqual(AS_STRING(a), AS_STRING(b));
+      return AS_OBJECT(a) == AS_OBJECT(b);
     default: return false;
   }
 }
@@ -0,0 +1,44 @@
+#!/bin/sh
+# Runs each test script against the interpreter given as $1 and compares
+# what it prints with the "// expect: " comments in the script, in order.
+# A "// expect runtime error: " comment names the message the script must
+# stop with. Scripts without expectations, such as loop.mkro, are skipped.
+# Scripts run from this directory, so the files they read are named
+# relative to it. A "// flags: " comment gives options to run them with.
+
+makro=$(cd "$(dirname "${1:-./makro}")" && pwd)/$(basename "${1:-./makro}")
+cd "$(dirname "$0")" || exit 1
+failed=0
+passed=0
+
+for test in *.mkro */*.mkro; do
+  [ -f "$test" ] || continue
+  grep -q '// expect' "$test" || continue
+
+  expected=$(sed -n 's|.*// expect: ||p' "$test")
+  error=$(sed -n 's|.*// expect runtime error: ||p' "$test")
+  flags=$(sed -n 's|^// flags: ||p' "$test")
+
+  actual=$("$makro" $flags "$test" 2> /tmp/makro-test-stderr.$$)
+  status=$?
+  message=$(head -n 1 /tmp/makro-test-stderr.$$)
+
+  if [ "$actual" != "$expected" ]; then
+    echo "FAIL $test: output differs"
+    printf '%s\n' "$expected" > /tmp/makro-test-expected.$$
+    printf '%s\n' "$actual" | diff /tmp/makro-test-expected.$$ - | head -n 20
+    failed=$((failed + 1))
+  elif [ -n "$error" ] && { [ $status -ne 70 ] || [ "$message" != "$error" ]; }; then
+    echo "FAIL $test: expected runtime error '$error', got status $status '$message'"
+    failed=$((failed + 1))
+  elif [ -z "$error" ] && [ $status -ne 0 ]; then
+    echo "FAIL $test: exited with status $status: $message"
+    failed=$((failed + 1))
+  else
+    passed=$((passed + 1))
+  fi
+done
+
+rm -f /tmp/makro-test-stderr.$$ /tmp/makro-test-expected.$$
+echo "$passed passed, $failed failed"
+[ $failed -eq 0 ]